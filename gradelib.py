@@ -600,3 +600,62 @@ def shell_script(script, terminate_match=None):
                         raise TerminateTest
         runner.qemu.on_output.append(handle_output)
     return setup_call_on_line
+
+##################################################################
+# Benchmarks
+#
+
+__all__ += ["run_bench", "load_baseline", "save_baseline", "compare_bench"]
+
+def run_bench(runner, cpus, args="", timeout=300):
+    """Boot with CPUS=cpus, run user/bench with args, and return its
+    results as a dict from benchmark name to nanoseconds per
+    operation."""
+
+    runner.run_qemu(shell_script(["bench " + args]),
+                    make_args=["CPUS=%d" % cpus], timeout=timeout)
+    results = {}
+    for m in re.finditer(r"^bench (\S+) (\d+) (\d+) (\d+)\r?$",
+                         runner.qemu.output, re.M):
+        results[m.group(1)] = int(m.group(3))
+    assert results, "no benchmark results in output"
+    return results
+
+def load_baseline(path):
+    """Return the baseline at path, a dict from CPU count (as a
+    string) to results as returned by run_bench, or {} if there
+    is none."""
+
+    import json
+    try:
+        with open(path) as f:
+            return json.load(f)
+    except IOError:
+        return {}
+
+def save_baseline(path, baseline):
+    import json
+    with open(path, "w") as f:
+        json.dump(baseline, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+def compare_bench(results, base, threshold):
+    """Compare results against base, results from a baseline run,
+    printing each benchmark's change in throughput. Fail if any
+    lost more than threshold (a fraction) of its throughput."""
+
+    slow = []
+    for name in sorted(results):
+        ns = results[name]
+        if name not in base:
+            print("    %-10s %8d ns/op" % (name, ns))
+            continue
+        # throughput is 1/ns
+        change = float(base[name]) / max(ns, 1) - 1
+        print("    %-10s %8d ns/op  baseline %8d  %+6.1f%%" %
+              (name, ns, base[name], change * 100))
+        if change < -threshold:
+            slow.append(name)
+    if slow:
+        raise AssertionError("throughput regressed more than %d%%: %s" %
+                             (threshold * 100, " ".join(slow)))
@@ -12,6 +12,9 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Block device drivers register themselves in bdevsw[],
+// indexed by the device number in b->dev.
 
 
 #include "types.h"
@@ -33,6 +36,17 @@ struct {
   struct buf head;
 } bcache;
 
+struct bdevsw bdevsw[NDEV];
+
+// Hand b to the driver for its device.
+static void
+bdevrw(struct buf *b, int write)
+{
+  if(b->dev >= NDEV || bdevsw[b->dev].rw == 0)
+    panic("bdevrw: no such device");
+  bdevsw[b->dev].rw(b, write);
+}
+
 void
 binit(void)
 {
@@ -96,7 +110,7 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    bdevrw(b, 0);
     b->valid = 1;
   }
   return b;
@@ -108,7 +122,7 @@ bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  bdevrw(b, 1);
 }
 
 // Release a locked buffer.
@@ -10,3 +10,13 @@ struct buf {
   uchar data[BSIZE];
 };
 
+
+// map block device number to driver functions.
+struct bdevsw {
+  void (*rw)(struct buf*, int);  // read (0) or write (1) b->data
+};
+
+extern struct bdevsw bdevsw[];
+
+#define VIRTIO_DISK 1
+#define RAM_DISK    2
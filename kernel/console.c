@@ -54,20 +54,20 @@ struct {
 
 //
 // user write()s to the console go here.
+// no cons.lock: uartputc() has its own lock and may sleep,
+// and either_copyin() may have to page in from a file.
 //
 int
 consolewrite(int user_src, uint64 src, int n)
 {
   int i;
 
-  acquire(&cons.lock);
   for(i = 0; i < n; i++){
     char c;
     if(either_copyin(&c, user_src, src+i, 1) == -1)
       break;
     uartputc(c);
   }
-  release(&cons.lock);
 
   return i;
 }
@@ -2,12 +2,15 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct mm;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
+struct stats;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -32,7 +35,14 @@ struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
+int             filereaddir(struct file*, uint64, int);
 int             filewrite(struct file*, uint64, int n);
+int             filesend(struct file*, struct file*, int);
+
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
 
 // fs.c
 void            fsinit(int);
@@ -51,18 +61,27 @@ struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
+short           itype(uint, uint);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 
+// prof.c
+void            profinit(void);
+void            profsample(uint64, int);
+void            profctl(int);
+int             profread(uint64, int);
+extern int      profiling;
+
 // ramdisk.c
 void            ramdiskinit(void);
-void            ramdiskintr(void);
-void            ramdiskrw(struct buf*);
+void            ramdiskrw(struct buf*, int);
 
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kref(void *);
+int             krefcount(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -74,7 +93,14 @@ void            end_op(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
+
+// pcache.c
+void            pcacheinit(void);
+uint64          pcachelookup(struct inode*, uint);
+uint64          pcacheget(struct inode*, uint);
+void            pcachewrite(struct inode*, uint, char*, uint);
+void            pcacheinval(struct inode*);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,8 +111,20 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
-pagetable_t     proc_pagetable(struct proc *);
+uint64          growproc(int);
+int             clone(uint64, uint64, uint64);
+int             spawn(char*, char**);
+int             join(int, uint64);
+struct mm*      mmalloc(void);
+void            mmput(struct mm*);
+void            mmexit(struct mm*);
+int             killthreads(int);
+void            mmleave(struct mm*, uint64);
+void            mmswitch(struct proc*);
+struct files*   filesalloc(void);
+struct files*   filescopy(struct files*);
+void            filesput(struct files*);
+pagetable_t     proc_pagetable(struct mm *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
 struct cpu*     mycpu(void);
@@ -100,10 +138,15 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
+void            wakeproc(struct proc*, void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
+int             asidbegin(pagetable_t);
+void            asidend(int);
 void            procdump(void);
+extern struct stats stats;
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -140,10 +183,7 @@ int             fetchaddr(uint64, uint64*);
 void            syscall();
 
 // trap.c
-extern uint     ticks;
-void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            usertrapret(void);
 
 // uart.c
@@ -154,24 +194,58 @@ void            uartputc_sync(int);
 int             uartgetc(void);
 
 // vm.c
+extern int      useasids;
 void            kvminit(void);
 void            kvminithart(void);
+void            kvmswitch(pagetable_t, int);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
+pagetable_t     kvmcreate(void);
+void            kvmfree(pagetable_t);
+int             kvmmapuser(pagetable_t, pagetable_t, uint64, uint64);
+void            kvmunmapuser(pagetable_t, uint64, uint64);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// vmcopyin.c
+int             copyin_new(pagetable_t, char *, uint64, uint64);
+int             copyinstr_new(pagetable_t, char *, uint64, uint64);
+
+// ucopy.S
+int             ucopy(char*, char*, uint64);
+int             ucopystr(char*, char*, uint64);
+
+// vma.c
+int             vmaload(pagetable_t, struct vma*);
+int             vmfault(pagetable_t, uint64, int);
+void            vmprefault(uint64, uint64, int);
+uint64          mmapbase(struct mm*);
+uint64          mmap(struct file*, uint64, int, int, uint);
+int             munmap(uint64, uint64);
+void            vmaunmapall(struct mm*);
+int             vmacopy(struct mm*, struct mm*);
+void            vmafree(struct vma*);
+
+// timer.c
+void            timersinit(void);
+void            timerset(void);
+int             timersleep(uint64);
+int             timerintr(void);
+void            kickidle(void);
+uint            uptime(void);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -185,3 +259,6 @@ void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+// count an event in stats (stats.h)
+#define STATINC(x) __sync_fetch_and_add(&stats.x, 1)
@@ -3,11 +3,14 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+static int flags2perm(int flags);
 
 int
 exec(char *path, char **argv)
@@ -18,7 +21,10 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
+  pagetable_t pagetable;
+  struct mm *mm = 0, *oldmm;
+  struct vma *v;
+  uint64 oldtrapva;
   struct proc *p = myproc();
 
   begin_op();
@@ -35,10 +41,17 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pagetable = proc_pagetable(p)) == 0)
+  // a new address space, in which this thread's trapframe
+  // goes in the usual place.
+  if((mm = mmalloc()) == 0)
     goto bad;
+  pagetable = mm->pagetable;
+  if(mappages(pagetable, TRAPFRAME, PGSIZE, (uint64)p->trapframe, PTE_R | PTE_W) < 0)
+    goto bad;
+  v = mm->vma;
 
-  // Load program into memory.
+  // Describe each segment with a vma, to be paged in from
+  // the file on demand (see vma.c).
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,21 +61,38 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz > PLIC)
       goto bad;
-    sz = sz1;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr < sz)  // overlaps the previous segment's pages
+      goto bad;
+    if(ph.off >= (1L << 32) || ph.filesz >= (1L << 32))  // vma fields are uint
+      goto bad;
+    if(ph.off + ph.filesz > ip->size)  // the file is cut short
+      goto bad;
+    if(v == &mm->vma[NVMA])
       goto bad;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->perm = flags2perm(ph.flags);
+    v->ip = ph.filesz ? idup(ip) : 0;
+    if(v->ip)
+      __sync_fetch_and_add(&ip->ntext, 1);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    // before vmaload(), so that bad: frees what it mapped
+    // if it runs out of memory partway through.
+    sz = v->end;
+    if(vmaload(pagetable, v) < 0)
+      goto bad;
+    v++;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
   p = myproc();
-  uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
@@ -73,6 +103,12 @@ exec(char *path, char **argv)
   sz = sz1;
   uvmclear(pagetable, sz-2*PGSIZE);
   sp = sz;
+  if(sz > PLIC)
+    goto bad;
+
+  // mirror the new user memory in the kernel page table.
+  if(kvmmapuser(pagetable, mm->kpagetable, 0, sz) < 0)
+    goto bad;
   stackbase = sp - PGSIZE;
 
   // Push argument strings, prepare rest of stack in ustack.
@@ -102,56 +138,64 @@ exec(char *path, char **argv)
   // value, which goes in a0.
   p->trapframe->a1 = sp;
 
+  // the new program runs without the other threads,
+  // which must be gone before the old image goes.
+  if(killthreads(0) < 0)
+    goto bad;
+
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
-  // Commit to the user image.
-  oldpagetable = p->pagetable;
-  p->pagetable = pagetable;
-  p->sz = sz;
+  // Commit to the user image. the new program starts
+  // with an empty ring.
+  mm->sz = sz;
+  mm->leader = p;
+  oldmm = p->mm;
+  oldtrapva = p->trapva;
+  p->mm = mm;
+  p->pagetable = mm->pagetable;
+  p->kpagetable = mm->kpagetable;
+  p->ring = mm->ring;
+  p->trapva = TRAPFRAME;
+  push_off();
+  mmswitch(p);
+  pop_off();
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  mmexit(oldmm);
+  mmleave(oldmm, oldtrapva);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
-  if(pagetable)
-    proc_freepagetable(pagetable, sz);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(mm){
+    begin_op();
+    vmafree(mm->vma);
+    end_op();
+    mm->sz = sz;
+    mmput(mm);
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
+// Page-table permissions for an ELF segment's flags.
 static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+flags2perm(int flags)
 {
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
+  int perm = 0;
+
+  if(flags & ELF_PROG_FLAG_READ)
+    perm |= PTE_R;
+  if(flags & ELF_PROG_FLAG_WRITE)
+    perm |= PTE_W;
+  if(flags & ELF_PROG_FLAG_EXEC)
+    perm |= PTE_X;
+  return perm;
 }
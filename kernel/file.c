@@ -101,6 +101,52 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read up to n entries from directory f, skipping free
+// ones, into the array of struct direntry at user address
+// addr, and return how many, 0 at the end, or -1.
+int
+filereaddir(struct file *f, uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct dirent de[32];
+  struct direntry e;
+  int r, i, got;
+
+  if(f->type != FD_INODE || f->readable == 0)
+    return -1;
+  for(got = 0; got < n; ){
+    ilock(f->ip);
+    if(f->ip->type != T_DIR){
+      iunlock(f->ip);
+      return -1;
+    }
+    r = n - got;  // slots to read, at least one per entry wanted
+    if(r > NELEM(de))
+      r = NELEM(de);
+    if((r = readi(f->ip, 0, (uint64)de, f->off, r * sizeof(de[0]))) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    if(r <= 0)
+      break;
+
+    // look up the types with the directory unlocked, as
+    // namex() does: ".." is an ancestor.
+    for(i = 0; i < r / sizeof(de[0]); i++){
+      if(de[i].inum == 0)
+        continue;
+      memset(&e, 0, sizeof(e));  // no stack garbage in the padding
+      e.inum = de[i].inum;
+      memmove(e.name, de[i].name, DIRSIZ);
+      e.name[DIRSIZ] = 0;
+      e.type = itype(f->ip->dev, e.inum);
+      if(copyout(p->pagetable, addr + got*sizeof(e), (char*)&e, sizeof(e)) < 0)
+        return -1;
+      got++;
+    }
+  }
+  return got;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -111,6 +157,11 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  // piperead() and consoleread() copy out with a spinlock
+  // held, and readi() with inode and buffer locks held, so
+  // they can't page the buffer in from a file.
+  vmprefault(addr, n, PTE_W);
+
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -129,22 +180,19 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
-// addr is a user virtual address.
-int
-filewrite(struct file *f, uint64 addr, int n)
+// Write n bytes from addr to file f. addr is a user
+// virtual address if user_src is 1, or a kernel address.
+static int
+write1(struct file *f, int user_src, uint64 addr, int n)
 {
   int r, ret = 0;
 
-  if(f->writable == 0)
-    return -1;
-
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
@@ -161,7 +209,7 @@ filewrite(struct file *f, uint64 addr, int n)
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, user_src, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
@@ -180,3 +228,54 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  if(f->writable == 0)
+    return -1;
+  vmprefault(addr, n, PTE_R);  // as in fileread()
+  return write1(f, 1, addr, n);
+}
+
+// Copy up to n bytes from file in, at its offset, to file
+// out, a page at a time through a kernel buffer, so that the
+// data never goes to user space. Returns the number of
+// bytes copied, 0 at the end of in, or -1.
+int
+filesend(struct file *out, struct file *in, int n)
+{
+  char *buf;
+  int r, w, done;
+
+  if(in->type != FD_INODE || in->readable == 0 || out->writable == 0)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+  for(done = 0; done < n; done += w){
+    r = n - done < PGSIZE ? n - done : PGSIZE;
+    ilock(in->ip);
+    r = readi(in->ip, 0, (uint64)buf, in->off, r);
+    iunlock(in->ip);
+    if(r <= 0)
+      break;
+    // advance in's offset only past what was written.
+    w = write1(out, 0, (uint64)buf, r);
+    if(w > 0){
+      ilock(in->ip);
+      in->off += w;
+      iunlock(in->ip);
+    }
+    if(w != r){
+      if(w > 0)
+        done += w;
+      else if(done == 0)
+        done = -1;
+      break;
+    }
+  }
+  kfree(buf);
+  return done;
+}
+
@@ -18,8 +18,10 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int ntext;          // Program segments mapping it (see vma.c); atomic
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int pcached;        // might have pages in the page cache?
 
   short type;         // copy of disk inode
   short major;
@@ -246,10 +246,12 @@ iget(uint dev, uint inum)
 
   acquire(&icache.lock);
 
-  // Is the inode already cached?
+  // Is the inode already cached? An unused entry still
+  // holds the inode it last did, up to date, and maybe
+  // pages of it in the page cache; take it back.
   empty = 0;
   for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+    if(ip->dev == dev && ip->inum == inum && (ip->ref > 0 || ip->valid)){
       ip->ref++;
       release(&icache.lock);
       return ip;
@@ -258,11 +260,14 @@ iget(uint dev, uint inum)
       empty = ip;
   }
 
-  // Recycle an inode cache entry.
+  // Recycle an inode cache entry, dropping the pages of
+  // the inode it held, which readi() and writei() will no
+  // longer keep up to date.
   if(empty == 0)
     panic("iget: no inodes");
 
   ip = empty;
+  pcacheinval(ip);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -413,6 +418,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcacheinval(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -436,6 +443,24 @@ itrunc(struct inode *ip)
   iupdate(ip);
 }
 
+// The type of inode inum on dev, without locking the inode:
+// the buffer cache holds the latest copy of the on-disk
+// inode, as changes go through the log. May be stale by the
+// time the caller looks, as with stat().
+short
+itype(uint dev, uint inum)
+{
+  struct buf *bp;
+  short type;
+
+  if(inum == 0 || inum >= sb.ninodes)
+    return 0;
+  bp = bread(dev, IBLOCK(inum, sb));
+  type = ((struct dinode*)bp->data + inum%IPB)->type;
+  brelse(bp);
+  return type;
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -457,6 +482,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  uint64 pa;
 
   if(off > ip->size || off + n < off)
     return 0;
@@ -464,8 +490,19 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    // the page cache is at least as new as the disk, since
+    // shared mappings store straight into it.
+    if(ip->pcached && ip->type == T_FILE &&
+       (pa = pcachelookup(ip, PGROUNDDOWN(off))) != 0){
+      if(either_copyout(user_dst, dst, (char*)pa + (off % PGSIZE), m) == -1){
+        kfree((void*)pa);
+        break;
+      }
+      kfree((void*)pa);
+      continue;
+    }
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       break;
@@ -489,6 +526,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->ntext > 0)  // running programs map its cached pages
+    return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -497,6 +536,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    pcachewrite(ip, off, (char*)bp->data + (off % BSIZE), m);
     log_write(bp);
     brelse(bp);
   }
@@ -618,6 +658,20 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Return a new reference to the current directory, which
+// another thread may change with chdir() meanwhile.
+static struct inode*
+cwdget(void)
+{
+  struct files *fs = myproc()->files;
+  struct inode *ip;
+
+  acquire(&fs->lock);
+  ip = idup(fs->cwd);
+  release(&fs->lock);
+  return ip;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
@@ -630,7 +684,7 @@ namex(char *path, int nameiparent, char *name)
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
-    ip = idup(myproc()->cwd);
+    ip = cwdget();
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
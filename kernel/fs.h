@@ -58,3 +58,10 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory entry and the type of its inode, from getdents().
+struct direntry {
+  ushort inum;
+  short type;
+  char name[DIRSIZ+1];  // NUL-terminated
+};
+
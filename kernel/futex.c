@@ -0,0 +1,86 @@
+//
+// Futexes: sleeping on a word of user memory.
+//
+// futexwait() sleeps, unless the word has changed, on a
+// channel that is the word's physical address, so that
+// threads of a process and processes sharing a MAP_SHARED
+// mapping of a file all meet on the same channel.
+// futexwake() wakes sleepers on it. The user-space mutexes
+// and condition variables in ulib.c are built on these.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+// checking the word and going to sleep are atomic with
+// respect to futexwake(), which makes lost wakeups
+// impossible as long as user code changes the word before
+// waking.
+struct spinlock futexlock;
+
+void
+futexinit(void)
+{
+  initlock(&futexlock, "futex");
+}
+
+// The physical address of the word at user address addr,
+// faulting the page in if need be, or 0.
+static uint64
+futexpa(uint64 addr)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+  int v;
+
+  if(addr % sizeof(int) != 0)
+    return 0;
+  if(copyin(p->pagetable, (char*)&v, addr, sizeof(v)) < 0)
+    return 0;
+  // once mapped, the page stays put: memory isn't
+  // unmapped while other threads are live.
+  if((pa = walkaddr(p->pagetable, addr)) == 0)
+    return 0;
+  return pa + (addr % PGSIZE);
+}
+
+// Sleep until futexwake() on addr, if the int there is
+// still val. Returns 0 if woken, or -1 if the value was
+// different, addr is bad, or the process was killed.
+int
+futexwait(uint64 addr, int val)
+{
+  uint64 pa;
+
+  if((pa = futexpa(addr)) == 0)
+    return -1;
+  acquire(&futexlock);
+  if(*(volatile int*)pa != val || myproc()->killed){
+    release(&futexlock);
+    return -1;
+  }
+  sleep((void*)pa, &futexlock);
+  release(&futexlock);
+  return 0;
+}
+
+// Wake up to n processes in futexwait() on addr.
+// Returns how many were woken, or -1 if addr is bad.
+int
+futexwake(uint64 addr, int n)
+{
+  uint64 pa;
+  int woke;
+
+  if((pa = futexpa(addr)) == 0)
+    return -1;
+  acquire(&futexlock);
+  woke = wakeupn((void*)pa, n);
+  release(&futexlock);
+  return woke;
+}
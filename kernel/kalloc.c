@@ -1,6 +1,9 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+// Pages are reference counted, so that a page of program
+// text can be mapped by several processes and the page
+// cache (pcache.c) at once; see kref().
 
 #include "types.h"
 #include "param.h"
@@ -18,9 +21,13 @@ struct run {
   struct run *next;
 };
 
+// index of physical page pa in kmem.ref[].
+#define PAGEIDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int ref[(PHYSTOP - KERNBASE) / PGSIZE];  // references to each page
 } kmem;
 
 void
@@ -35,14 +42,17 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kmem.ref[PAGEIDX(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, and free it if that was the last one. The page
+// normally should have been returned by a call to kalloc().
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(void *pa)
 {
@@ -51,6 +61,15 @@ kfree(void *pa)
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if(kmem.ref[PAGEIDX(pa)] < 1)
+    panic("kfree: ref");
+  if(--kmem.ref[PAGEIDX(pa)] > 0){
+    release(&kmem.lock);
+    return;
+  }
+  release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
@@ -72,11 +91,41 @@ kalloc(void)
 
   acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    kmem.ref[PAGEIDX(r)] = 1;
+  }
   release(&kmem.lock);
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Add a reference to a page returned by kalloc(), for
+// another page table or the page cache to share it.
+// kfree() drops a reference.
+void
+kref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PAGEIDX(pa)] < 1)
+    panic("kref: free page");
+  kmem.ref[PAGEIDX(pa)]++;
+  release(&kmem.lock);
+}
+
+// How many references are there to a page returned by kalloc()?
+int
+krefcount(void *pa)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[PAGEIDX(pa)];
+  release(&kmem.lock);
+  return n;
+}
@@ -20,14 +20,20 @@ main()
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
-    trapinit();      // trap vectors
+    timersinit();    // sleep deadlines
     trapinithart();  // install kernel trap vector
+    profinit();      // sampling profiler
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    pcacheinit();    // page cache, for demand-paged exec
     fileinit();      // file table
+    futexinit();     // user-space sleeping
     virtio_disk_init(); // emulated hard disk
+#ifdef RAMDISK_ROOT
+    ramdiskinit();   // in-memory disk image
+#endif
     userinit();      // first user process
     __sync_synchronize();
     started = 1;
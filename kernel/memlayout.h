@@ -10,12 +10,14 @@
 // 10001000 -- virtio disk 
 // 80000000 -- boot ROM jumps here in machine mode
 //             -kernel loads the kernel here
+// 88000000 -- -initrd loads fs.img here when booted with -m 256M
 // unused RAM after 80000000.
 
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
 // end -- start of kernel page allocation area
 // PHYSTOP -- end RAM used by the kernel
+// RAMDISK -- in-memory fs.img, with make DISK=ram
 
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
@@ -27,6 +29,7 @@
 
 // local interrupt controller, which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -47,6 +50,10 @@
 #define KERNBASE 0x80000000L
 #define PHYSTOP (KERNBASE + 128*1024*1024)
 
+// qemu puts the -initrd image halfway into RAM, which with
+// -m 256M is just past PHYSTOP, out of the way of kalloc().
+#define RAMDISK PHYSTOP
+
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
@@ -62,6 +69,10 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   THREADFRAME(i) (trapframes of threads made by clone())
+//   USYSRING (p->ring, shared with user, see sysring.h)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USYSRING (TRAPFRAME - PGSIZE)
+#define THREADFRAME(i) (USYSRING - ((i)+1)*PGSIZE)
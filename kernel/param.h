@@ -4,10 +4,20 @@
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
-#define ROOTDEV       1  // device number of file system root disk
+#ifdef RAMDISK_ROOT
+#define ROOTDEV       2  // device number of file system root disk (RAM_DISK)
+#else
+#define ROOTDEV       1  // device number of file system root disk (VIRTIO_DISK)
+#endif
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NVMA         16  // demand-paged regions per process
+#define NPCACHE     512  // pages in the page cache
+#define TIMEFREQ 10000000  // time CSR rate in qemu, in Hz
+#define TICK (TIMEFREQ/10) // time CSR units per tick
+#define QUANTUM TICK       // default time slice, see setquantum()
+#define SLSPIN (TIMEFREQ/50000) // max time acquiresleep() spins before sleeping
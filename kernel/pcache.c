@@ -0,0 +1,237 @@
+// Page cache: whole, page-aligned pages of file contents,
+// shared by demand-paged exec and mmap (see vma.c), and
+// consulted by readi().
+//
+// A cached page is identified by (dev, inum, off), and
+// found through a hash table on that key. Program text and
+// read-only or shared mappings map the cached page itself,
+// so every process running a program shares its text, and
+// shared mappings of a file see each other's stores.
+//
+// The cache holds one reference (kref()) to each of its
+// pages; every mapping adds another. Only pages that no one
+// maps are evicted, least recently used first, so a page
+// stays cached as long as a shared mapping might have
+// stored to it.
+//
+// Cached pages are kept up to date: writei() copies what it
+// writes into them (pcachewrite()), and readi() reads from
+// them in preference to the buffer cache, so that read()
+// sees stores to shared mappings before they are written
+// back. Both only look here for inodes with pcached set,
+// so the pages of an inode must go when its icache entry
+// is recycled, and do (iget()); itrunc() drops them too.
+// Running programs map their text pages, so writei()
+// refuses to write a file while it is being run.
+//
+// Entries are filled with the inode locked, so there is at
+// most one fill of a given inode's pages at a time.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCHASH 211
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;
+  uint64 pa;               // 0 if the entry is unused
+  struct pcpage *hnext;    // hash chain
+  struct pcpage *prev;     // LRU list
+  struct pcpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *hash[NPCHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used.
+  struct pcpage head;
+} pcache;
+
+static uint
+pchash(uint dev, uint inum, uint off)
+{
+  return (dev * 31 + inum * 131 + off / PGSIZE) % NPCHASH;
+}
+
+void
+pcacheinit(void)
+{
+  struct pcpage *e;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(e = pcache.page; e < pcache.page+NPCACHE; e++){
+    e->next = pcache.head.next;
+    e->prev = &pcache.head;
+    pcache.head.next->prev = e;
+    pcache.head.next = e;
+  }
+}
+
+// Move e to the front of the LRU list.
+// Caller must hold pcache.lock.
+static void
+touch(struct pcpage *e)
+{
+  e->next->prev = e->prev;
+  e->prev->next = e->next;
+  e->next = pcache.head.next;
+  e->prev = &pcache.head;
+  pcache.head.next->prev = e;
+  pcache.head.next = e;
+}
+
+// Remove e from its hash chain, and drop the cache's
+// reference to its page.
+// Caller must hold pcache.lock.
+static void
+drop(struct pcpage *e)
+{
+  struct pcpage **pp;
+
+  for(pp = &pcache.hash[pchash(e->dev, e->inum, e->off)]; *pp != e; pp = &(*pp)->hnext)
+    ;
+  *pp = e->hnext;
+  kfree((void*)e->pa);
+  e->pa = 0;
+}
+
+// Caller must hold pcache.lock.
+static struct pcpage*
+lookup(struct inode *ip, uint off)
+{
+  struct pcpage *e;
+
+  for(e = pcache.hash[pchash(ip->dev, ip->inum, off)]; e; e = e->hnext)
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == off)
+      return e;
+  return 0;
+}
+
+// Return the page at offset off of ip, if it is cached,
+// with a reference for the caller; kfree() drops it.
+// Returns 0 if it isn't.
+uint64
+pcachelookup(struct inode *ip, uint off)
+{
+  struct pcpage *e;
+  uint64 pa = 0;
+
+  if(off % PGSIZE)
+    panic("pcachelookup");
+
+  acquire(&pcache.lock);
+  if((e = lookup(ip, off)) != 0){
+    touch(e);
+    kref((void*)e->pa);
+    pa = e->pa;
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Return a page holding bytes [off, off+PGSIZE) of ip,
+// zero past the end of the file, with a reference for the
+// caller. Reads the page into the cache if it isn't there.
+// Returns 0 if out of memory, or if every cached page is
+// in use.
+// Caller must hold ip->lock.
+uint64
+pcacheget(struct inode *ip, uint off)
+{
+  struct pcpage *e;
+  char *mem;
+  uint64 pa;
+
+  if((pa = pcachelookup(ip, off)) != 0)
+    return pa;
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  if(readi(ip, 0, (uint64)mem, off, PGSIZE) < 0){
+    kfree(mem);
+    return 0;
+  }
+
+  // ip->lock keeps anyone else from adding this page
+  // meanwhile. take the least recently used entry that
+  // is free or that no one maps.
+  acquire(&pcache.lock);
+  for(e = pcache.head.prev; e != &pcache.head; e = e->prev)
+    if(e->pa == 0 || krefcount((void*)e->pa) == 1)
+      break;
+  if(e == &pcache.head){
+    release(&pcache.lock);
+    kfree(mem);
+    return 0;
+  }
+  if(e->pa)
+    drop(e);
+  e->dev = ip->dev;
+  e->inum = ip->inum;
+  e->off = off;
+  e->pa = (uint64)mem;
+  e->hnext = pcache.hash[pchash(ip->dev, ip->inum, off)];
+  pcache.hash[pchash(ip->dev, ip->inum, off)] = e;
+  touch(e);
+  ip->pcached = 1;
+  kref(mem);
+  release(&pcache.lock);
+
+  return (uint64)mem;
+}
+
+// writei() wrote n bytes from src at offset off of ip;
+// copy them into the cached page, if any.
+// [off, off+n) must lie within one page.
+// Caller must hold ip->lock.
+void
+pcachewrite(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcpage *e;
+
+  if(!ip->pcached)
+    return;
+  if(off / PGSIZE != (off + n - 1) / PGSIZE)
+    panic("pcachewrite");
+
+  acquire(&pcache.lock);
+  if((e = lookup(ip, PGROUNDDOWN(off))) != 0)
+    memmove((char*)e->pa + off % PGSIZE, src, n);
+  release(&pcache.lock);
+}
+
+// Drop the cached pages of ip, which is being truncated,
+// or whose icache entry is being recycled (see iget()).
+// Processes that map them keep their copies.
+// Caller must hold ip->lock, or icache.lock if ip->ref is 0.
+void
+pcacheinval(struct inode *ip)
+{
+  struct pcpage *e;
+
+  // cheap test for the common case of a file that
+  // was never executed or mapped: pcacheget() sets it.
+  if(!ip->pcached)
+    return;
+
+  acquire(&pcache.lock);
+  for(e = pcache.page; e < &pcache.page[NPCACHE]; e++)
+    if(e->pa && e->dev == ip->dev && e->inum == ip->inum)
+      drop(e);
+  ip->pcached = 0;
+  release(&pcache.lock);
+}
@@ -73,29 +73,36 @@ pipeclose(struct pipe *pi, int writable)
     release(&pi->lock);
 }
 
+// Write n bytes from addr, a user virtual address if
+// user_src is 1, or a kernel address.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
-  int i;
-  char ch;
+  int i, j, m;
+  char buf[128];
   struct proc *pr = myproc();
 
-  acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || pr->killed){
-        release(&pi->lock);
-        return -1;
+  for(i = 0; i < n; i += m){
+    // copy from user space before taking pi->lock, since
+    // copyin() may have to page in from a file (vma.c).
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for(j = 0; j < m; j++){
+      while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
+        if(pi->readopen == 0 || pr->killed){
+          release(&pi->lock);
+          return -1;
+        }
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
       }
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
+      pi->data[pi->nwrite++ % PIPESIZE] = buf[j];
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-      break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    wakeup(&pi->nread);
+    release(&pi->lock);
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
   return i;
 }
 
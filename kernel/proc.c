@@ -5,29 +5,51 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "stats.h"
 
 struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
+struct mm mmtab[NPROC];
+
+struct files filestab[NPROC];
+
+struct stats stats;
+
 struct proc *initproc;
 
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// helps ensure that wakeups of wait()ing
+// parents are not lost. protects the parent,
+// children, zombies and sibling links of every
+// proc. must be acquired before any p->lock.
+struct spinlock wait_lock;
+
 extern void forkret(void);
+static void spawnret(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
+static void listadd(struct proc **head, struct proc *p);
+static void killproc(struct proc *p);
+static int reap(uint64 addr, int thread, int tid);
 
 extern char trampoline[]; // trampoline.S
 
+extern pagetable_t kernel_pagetable; // vm.c
+
 // initialize the proc table at boot time.
 void
 procinit(void)
 {
   struct proc *p;
+  struct mm *mm;
+  struct files *fs;
   
   initlock(&pid_lock, "nextpid");
+  initlock(&wait_lock, "wait_lock");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
 
@@ -41,6 +63,19 @@ procinit(void)
       kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
       p->kstack = va;
   }
+  for(mm = mmtab; mm < &mmtab[NPROC]; mm++) {
+      initlock(&mm->lock, "mm");
+
+      // Each address space slot owns two ASIDs, for its
+      // user and kernel page tables. ASID 0 is the global
+      // kernel page table's.
+      if(useasids){
+        mm->asid = 2*(mm - mmtab) + 1;
+        mm->kasid = 2*(mm - mmtab) + 2;
+      }
+  }
+  for(fs = filestab; fs < &filestab[NPROC]; fs++)
+      initlock(&fs->lock, "files");
   kvminithart();
 }
 
@@ -106,21 +141,17 @@ allocproc(void)
 
 found:
   p->pid = allocpid();
+  p->quantum = QUANTUM;
+  p->sliceleft = p->quantum;
+  p->boost = 0;
 
-  // Allocate a trapframe page.
+  // Allocate a trapframe page. The caller gives p an
+  // address space, and maps the trapframe in it.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
     release(&p->lock);
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -136,15 +167,20 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  if(p->mm)
+    mmleave(p->mm, p->trapva);
+  p->mm = 0;
+  p->pagetable = 0;
+  p->kpagetable = 0;
+  p->ring = 0;
+  p->trapva = 0;
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
   p->pid = 0;
   p->parent = 0;
+  p->sibnext = p->sibprev = 0;
+  p->thread = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
@@ -152,10 +188,266 @@ freeproc(struct proc *p)
   p->state = UNUSED;
 }
 
-// Create a user page table for a given process,
+// Allocate an address space with no user memory: a user
+// page table with the trampoline and the syscall ring, and
+// an empty kernel page table, in which user memory will be
+// mirrored. Returns 0 if out of memory.
+struct mm*
+mmalloc(void)
+{
+  struct mm *mm;
+
+  for(mm = mmtab; mm < &mmtab[NPROC]; mm++) {
+    acquire(&mm->lock);
+    if(mm->ref == 0) {
+      mm->ref = 1;
+      mm->nlive = 1;
+      release(&mm->lock);
+      goto found;
+    }
+    release(&mm->lock);
+  }
+  return 0;
+
+found:
+  // Allocate the page shared with user space for ringenter().
+  if((mm->ring = (struct sysring *)kalloc()) == 0){
+    mmput(mm);
+    return 0;
+  }
+  memset(mm->ring, 0, PGSIZE);
+
+  if((mm->pagetable = proc_pagetable(mm)) == 0 ||
+     (mm->kpagetable = kvmcreate()) == 0){
+    mmput(mm);
+    return 0;
+  }
+  return mm;
+}
+
+// Drop a reference to mm, freeing its memory and page
+// tables with the last one.
+void
+mmput(struct mm *mm)
+{
+  acquire(&mm->lock);
+  if(--mm->ref > 0){
+    release(&mm->lock);
+    return;
+  }
+  if(mm->ring)
+    kfree((void*)mm->ring);
+  mm->ring = 0;
+  if(mm->pagetable)
+    proc_freepagetable(mm->pagetable, mm->sz);
+  mm->pagetable = 0;
+  if(mm->kpagetable)
+    kvmfree(mm->kpagetable);
+  mm->kpagetable = 0;
+  mm->sz = 0;
+  memset(mm->vma, 0, sizeof(mm->vma));  // inodes released by mmexit()
+  mm->nlive = 0;
+  mm->leader = 0;
+  mm->killer = 0;
+  mm->ringbusy = 0;
+
+  // the next address space in this slot reuses the ASIDs;
+  // make every CPU flush them first.
+  mm->tlbgen++;
+  release(&mm->lock);
+}
+
+// Called by a thread that is done with user memory, when it
+// exits or execs. The last live thread of mm writes back and
+// releases its mmap()ed files and program inodes; the memory
+// stays until mmput(), as other threads' trapframes are in it.
+void
+mmexit(struct mm *mm)
+{
+  int last;
+
+  acquire(&mm->lock);
+  last = --mm->nlive == 0;
+  release(&mm->lock);
+  if(!last){
+    wakeup(mm);  // killthreads() may be waiting
+    return;
+  }
+
+  vmaunmapall(mm);
+  begin_op();
+  vmafree(mm->vma);
+  end_op();
+}
+
+// Allocate an empty table of open files, with no current
+// directory. Returns 0 if none is free.
+struct files*
+filesalloc(void)
+{
+  struct files *fs;
+
+  for(fs = filestab; fs < &filestab[NPROC]; fs++) {
+    acquire(&fs->lock);
+    if(fs->ref == 0) {
+      fs->ref = 1;
+      release(&fs->lock);
+      return fs;
+    }
+    release(&fs->lock);
+  }
+  return 0;
+}
+
+// Allocate a copy of from, for fork() and spawn(), with
+// new references to its files and current directory.
+// Returns 0 if none is free.
+struct files*
+filescopy(struct files *from)
+{
+  struct files *fs;
+  int i;
+
+  if((fs = filesalloc()) == 0)
+    return 0;
+  acquire(&from->lock);
+  for(i = 0; i < NOFILE; i++)
+    if(from->ofile[i])
+      fs->ofile[i] = filedup(from->ofile[i]);
+  fs->cwd = idup(from->cwd);
+  release(&from->lock);
+  return fs;
+}
+
+// Drop a reference to fs, closing its files and releasing
+// its current directory with the last one.
+void
+filesput(struct files *fs)
+{
+  struct file *ofile[NOFILE];
+  struct inode *cwd;
+  int i;
+
+  acquire(&fs->lock);
+  if(--fs->ref > 0){
+    release(&fs->lock);
+    return;
+  }
+  // closing may sleep; take everything out of fs first,
+  // and then it can be handed out again.
+  memmove(ofile, fs->ofile, sizeof(ofile));
+  memset(fs->ofile, 0, sizeof(fs->ofile));
+  cwd = fs->cwd;
+  fs->cwd = 0;
+  release(&fs->lock);
+
+  for(i = 0; i < NOFILE; i++)
+    if(ofile[i])
+      fileclose(ofile[i]);
+  if(cwd){
+    begin_op();
+    iput(cwd);
+    end_op();
+  }
+}
+
+// Kill the other threads of the current process, and wait
+// for them to exit, for exit() of the process and for
+// exec(). Returns 0, or -1 if another thread got there
+// first, or if the caller was killed meanwhile and isn't
+// exiting anyway.
+int
+killthreads(int exiting)
+{
+  struct proc *p = myproc(), *pp;
+  struct mm *mm = p->mm;
+  int r;
+
+  acquire(&mm->lock);
+  if(mm->nlive == 1){
+    release(&mm->lock);
+    return 0;
+  }
+  if(mm->killer != 0){
+    // it is killing this thread too.
+    release(&mm->lock);
+    return -1;
+  }
+  mm->killer = p;  // and clone() fails from now on
+  release(&mm->lock);
+
+  for(pp = proc; pp < &proc[NPROC]; pp++){
+    if(pp == p)
+      continue;
+    acquire(&pp->lock);
+    if(pp->mm == mm)
+      killproc(pp);
+    release(&pp->lock);
+  }
+
+  // each wakes us in mmexit().
+  acquire(&mm->lock);
+  while(mm->nlive > 1 && (exiting || !p->killed))
+    sleep(mm, &mm->lock);
+  if((r = mm->nlive > 1 ? -1 : 0) < 0)
+    mm->killer = 0;
+  release(&mm->lock);
+  return r;
+}
+
+// Make mm p's address space, and map p's trapframe in it
+// at va. Caller must hold mm->lock if mm is shared.
+static int
+mmenter(struct proc *p, struct mm *mm, uint64 va)
+{
+  if(mappages(mm->pagetable, va, PGSIZE,
+              (uint64)(p->trapframe), PTE_R | PTE_W) < 0)
+    return -1;
+  if(mm->leader == 0)
+    mm->leader = p;
+  p->mm = mm;
+  p->pagetable = mm->pagetable;
+  p->kpagetable = mm->kpagetable;
+  p->ring = mm->ring;
+  p->trapva = va;
+  return 0;
+}
+
+// Unmap a trapframe at va from mm, and drop the reference
+// to mm. No CPU may still be using the trapframe through
+// mm's ASID: the slot can be handed to another thread.
+void
+mmleave(struct mm *mm, uint64 va)
+{
+  acquire(&mm->lock);
+  uvmunmap(mm->pagetable, va, 1, 0);
+  __sync_fetch_and_add(&mm->tlbgen, 1);
+  release(&mm->lock);
+  mmput(mm);
+}
+
+// Switch this CPU to p's kernel page table, flushing p's
+// ASIDs first if their mappings have changed since this CPU
+// last did. Interrupts must be disabled.
+void
+mmswitch(struct proc *p)
+{
+  struct mm *mm = p->mm;
+  struct cpu *c = mycpu();
+  uint64 gen = mm->tlbgen;
+
+  kvmswitch(mm->kpagetable, mm->kasid);
+  if(useasids && c->tlbgen[mm - mmtab] != gen){
+    sfence_vma_asid(mm->asid);
+    sfence_vma_asid(mm->kasid);
+    c->tlbgen[mm - mmtab] = gen;
+  }
+}
+
+// Create a user page table for an address space,
 // with no user memory, but with trampoline pages.
 pagetable_t
-proc_pagetable(struct proc *p)
+proc_pagetable(struct mm *mm)
 {
   pagetable_t pagetable;
 
@@ -174,9 +466,10 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe just below TRAMPOLINE, for trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
-              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+  // map the syscall ring below TRAPFRAME, for user code
+  // and ringenter(). the trapframes are mapped by mmenter().
+  if(mappages(pagetable, USYSRING, PGSIZE,
+              (uint64)(mm->ring), PTE_R | PTE_W | PTE_U) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
@@ -192,6 +485,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USYSRING, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -212,21 +506,28 @@ void
 userinit(void)
 {
   struct proc *p;
+  struct mm *mm;
 
   p = allocproc();
   initproc = p;
+  if((mm = mmalloc()) == 0 || mmenter(p, mm, TRAPFRAME) < 0)
+    panic("userinit: mmalloc");
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  mm->sz = PGSIZE;
+  if(kvmmapuser(p->pagetable, p->kpagetable, 0, mm->sz) < 0)
+    panic("userinit: kvmmapuser");
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  if((p->files = filesalloc()) == 0)
+    panic("userinit: filesalloc");
+  p->files->cwd = namei("/");
 
   p->state = RUNNABLE;
 
@@ -234,23 +535,41 @@ userinit(void)
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Return the old size on success, -1 on failure.
+uint64
 growproc(int n)
 {
-  uint sz;
-  struct proc *p = myproc();
+  uint64 sz, oldsz;
+  struct mm *mm = myproc()->mm;
 
-  sz = p->sz;
+  acquire(&mm->lock);
+  sz = oldsz = mm->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    // user memory must stay below PLIC, where the
+    // kernel page table's device mappings start, and
+    // below any mmap()ed files.
+    if(sz + n > mmapbase(mm) || (sz = uvmalloc(mm->pagetable, sz, sz + n)) == 0) {
+      release(&mm->lock);
+      return -1;
+    }
+    if(kvmmapuser(mm->pagetable, mm->kpagetable, mm->sz, sz) < 0){
+      uvmdealloc(mm->pagetable, sz, mm->sz);
+      release(&mm->lock);
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    // other CPUs may have the pages in their TLBs, and there
+    // is no way to make them flush while the threads run.
+    if(mm->nlive > 1){
+      release(&mm->lock);
+      return -1;
+    }
+    sz = uvmdealloc(mm->pagetable, sz, sz + n);
+    kvmunmapuser(mm->kpagetable, mm->sz, sz);
   }
-  p->sz = sz;
-  return 0;
+  mm->sz = sz;
+  release(&mm->lock);
+  return oldsz;
 }
 
 // Create a new process, copying the parent.
@@ -258,24 +577,54 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct mm *mm;
 
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
+  if((mm = mmalloc()) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  if(mmenter(np, mm, TRAPFRAME) < 0){
+    mmput(mm);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. the child
+  // pages in the parts of the program that neither has
+  // touched yet from the same files, and gets copies of
+  // the parent's mmap()ed files.
+  acquire(&p->mm->lock);
+  if(uvmcopy(p->pagetable, np->pagetable, 0, p->mm->sz, 0) < 0){
+    release(&p->mm->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  mm->sz = p->mm->sz;
+  if(kvmmapuser(np->pagetable, np->kpagetable, 0, mm->sz) < 0 ||
+     vmacopy(mm, p->mm) < 0){
+    release(&p->mm->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  release(&p->mm->lock);
 
-  np->parent = p;
+  // increment reference counts on open file descriptors.
+  if((np->files = filescopy(p->files)) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -283,52 +632,244 @@ fork(void)
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
+  np->quantum = np->sliceleft = p->quantum;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
 
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  listadd(&p->children, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
   np->state = RUNNABLE;
+  release(&np->lock);
+  kickidle();
 
+  return pid;
+}
+
+// Create a child process running path with argv, as fork()
+// followed by exec() in the child would, but without
+// copying this process's memory: the child starts with an
+// empty address space and execs in spawnret(). path and
+// argv are kernel copies; they must stay put until the
+// exec() is done, so spawn() waits for it. Returns the
+// child's pid, or -1 if it couldn't be made or exec() failed.
+int
+spawn(char *path, char **argv)
+{
+  int pid, res;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm;
+
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+  if((mm = mmalloc()) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  if(mmenter(np, mm, TRAPFRAME) < 0){
+    mmput(mm);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  if((np->files = filescopy(p->files)) == 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  np->context.ra = (uint64)spawnret;
+  np->spawnpath = path;
+  np->spawnargv = argv;
+  np->quantum = np->sliceleft = p->quantum;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->spawnres = 0;
+  listadd(&p->children, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
   release(&np->lock);
+  kickidle();
 
+  // np can't be reaped before it sets spawnres.
+  acquire(&wait_lock);
+  while((res = np->spawnres) == 0)
+    sleep(np, &wait_lock);
+  release(&wait_lock);
+
+  if(res < 0){
+    reap(0, 0, pid);
+    return -1;
+  }
   return pid;
 }
 
-// Pass p's abandoned children to init.
-// Caller must hold p->lock.
+// Create a thread: a process that shares the caller's
+// address space, and starts in user space at fn(arg) on
+// stack. It shares the caller's open files and current
+// directory too, and is reaped with join() rather than wait().
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int tid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // the trapframe goes in a slot of its own, below the
+  // ones that exec() and fork() use.
+  acquire(&mm->lock);
+  if(mm->killer != 0 || mmenter(np, mm, THREADFRAME(np - proc)) < 0){
+    release(&mm->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  mm->ref++;
+  mm->nlive++;
+  release(&mm->lock);
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  np->quantum = np->sliceleft = p->quantum;
+
+  acquire(&p->files->lock);
+  p->files->ref++;
+  release(&p->files->lock);
+  np->files = p->files;
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  tid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  np->thread = 1;
+  listadd(&p->children, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+  kickidle();
+
+  return tid;
+}
+
+// Add p to the circular list at *head.
+// Caller must hold wait_lock.
+static void
+listadd(struct proc **head, struct proc *p)
+{
+  if(*head == 0){
+    p->sibnext = p->sibprev = p;
+    *head = p;
+    return;
+  }
+  p->sibnext = *head;
+  p->sibprev = (*head)->sibprev;
+  p->sibprev->sibnext = p;
+  (*head)->sibprev = p;
+}
+
+// Remove p from the circular list at *head.
+// Caller must hold wait_lock.
+static void
+listdel(struct proc **head, struct proc *p)
+{
+  if(p->sibnext == p){
+    *head = 0;
+  } else {
+    p->sibprev->sibnext = p->sibnext;
+    p->sibnext->sibprev = p->sibprev;
+    if(*head == p)
+      *head = p->sibnext;
+  }
+  p->sibnext = p->sibprev = 0;
+}
+
+// Move all of the circular list l onto the end of
+// the one at *head.
+// Caller must hold wait_lock.
+static void
+listsplice(struct proc **head, struct proc *l)
+{
+  struct proc *tail;
+
+  if(l == 0)
+    return;
+  if(*head == 0){
+    *head = l;
+    return;
+  }
+  tail = l->sibprev;
+  l->sibprev = (*head)->sibprev;
+  l->sibprev->sibnext = l;
+  tail->sibnext = *head;
+  (*head)->sibprev = tail;
+}
+
+// Pass p's abandoned children to init, waking init
+// if any of them have already exited.
+// Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    // this code uses pp->parent without holding pp->lock.
-    // acquiring the lock first could cause a deadlock
-    // if pp or a child of pp were also in exit()
-    // and about to try to lock p.
-    if(pp->parent == p){
-      // pp->parent can't change between the check and the acquire()
-      // because only the parent changes it, and we're the parent.
-      acquire(&pp->lock);
+  // init reaps orphaned threads with wait().
+  if((pp = p->children) != 0){
+    do {
       pp->parent = initproc;
-      // we should wake up init here, but that would require
-      // initproc->lock, which would be a deadlock, since we hold
-      // the lock on one of init's children (pp). this is why
-      // exit() always wakes init (before acquiring any locks).
-      release(&pp->lock);
-    }
+      pp->thread = 0;
+    } while((pp = pp->sibnext) != p->children);
+    listsplice(&initproc->children, p->children);
+    p->children = 0;
+  }
+
+  if((pp = p->zombies) != 0){
+    do {
+      pp->parent = initproc;
+      pp->thread = 0;
+    } while((pp = pp->sibnext) != p->zombies);
+    listsplice(&initproc->zombies, p->zombies);
+    p->zombies = 0;
+    acquire(&initproc->lock);
+    wakeup1(initproc);
+    release(&initproc->lock);
   }
 }
 
-// Exit the current process.  Does not return.
+// Exit the current process or thread.  Does not return.
 // An exited process remains in the zombie state
-// until its parent calls wait().
+// until its parent calls wait(), or join() for a thread.
 void
 exit(int status)
 {
@@ -337,119 +878,175 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // the process's exit ends all of its threads, before
+  // its parent can see it exit.
+  if(p == p->mm->leader)
+    killthreads(1);
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
-
-  // we might re-parent a child to init. we can't be precise about
-  // waking up init, since we can't acquire its lock once we've
-  // acquired any other proc lock. so wake up init whether that's
-  // necessary or not. init may miss this wakeup, but that seems
-  // harmless.
-  acquire(&initproc->lock);
-  wakeup1(initproc);
-  release(&initproc->lock);
-
-  // grab a copy of p->parent, to ensure that we unlock the same
-  // parent we locked. in case our parent gives us away to init while
-  // we're waiting for the parent lock. we may then race with an
-  // exiting parent, but the result will be a harmless spurious wakeup
-  // to a dead or wrong process; proc structs are never re-allocated
-  // as anything else.
-  acquire(&p->lock);
-  struct proc *original_parent = p->parent;
-  release(&p->lock);
-  
-  // we need the parent's lock in order to wake it up from wait().
-  // the parent-then-child rule says we have to lock it first.
-  acquire(&original_parent->lock);
+  // Close all open files, unless other threads still use them.
+  filesput(p->files);
+  p->files = 0;
 
-  acquire(&p->lock);
+  mmexit(p->mm);
+
+  acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
   // Parent might be sleeping in wait().
-  wakeup1(original_parent);
+  listdel(&p->parent->children, p);
+  listadd(&p->parent->zombies, p);
+  acquire(&p->parent->lock);
+  wakeup1(p->parent);
+  release(&p->parent->lock);
+
+  acquire(&p->lock);
 
   p->xstate = status;
   p->state = ZOMBIE;
 
-  release(&original_parent->lock);
+  release(&wait_lock);
 
   // Jump into the scheduler, never to return.
   sched();
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Find the first process in the circular list at head
+// that is a thread or not, as thread says, and has the
+// given pid, or any if pid is 0.
+// Caller must hold wait_lock.
+static struct proc*
+listfind(struct proc *head, int thread, int pid)
+{
+  struct proc *pp;
+
+  if((pp = head) == 0)
+    return 0;
+  do {
+    if(pp->thread == thread && (pid == 0 || pp->pid == pid))
+      return pp;
+  } while((pp = pp->sibnext) != head);
+  return 0;
+}
+
+// Wait for a child process, or for the thread tid if
+// thread is set, to exit. Returns its pid, or -1 if there
+// is no such child.
+static int
+reap(uint64 addr, int thread, int tid)
 {
   struct proc *np;
-  int havekids, pid;
+  int pid;
   struct proc *p = myproc();
 
-  // hold p->lock for the whole time to avoid lost
+  // hold wait_lock for the whole time to avoid lost
   // wakeups from a child's exit().
-  acquire(&p->lock);
+  acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      // this code uses np->parent without holding np->lock.
-      // acquiring the lock first would cause a deadlock,
-      // since np might be an ancestor, and we already hold p->lock.
-      if(np->parent == p){
-        // np->parent can't change between the check and the acquire()
-        // because only the parent changes it, and we're the parent.
-        acquire(&np->lock);
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
-          freeproc(np);
-          release(&np->lock);
-          release(&p->lock);
-          return pid;
-        }
+    if((np = listfind(p->zombies, thread, tid)) != 0){
+      // np holds its lock until it has left its CPU
+      // for good, in sched().
+      acquire(&np->lock);
+      pid = np->pid;
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                              sizeof(np->xstate)) < 0) {
         release(&np->lock);
+        release(&wait_lock);
+        return -1;
       }
+      listdel(&p->zombies, np);
+      freeproc(np);
+      release(&np->lock);
+      release(&wait_lock);
+      return pid;
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || p->killed){
-      release(&p->lock);
+    if(listfind(p->children, thread, tid) == 0 || p->killed){
+      release(&wait_lock);
       return -1;
     }
     
     // Wait for a child to exit.
-    sleep(p, &p->lock);  //DOC: wait-sleep
+    sleep(p, &wait_lock);  //DOC: wait-sleep
+  }
+}
+
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr)
+{
+  return reap(addr, 0, 0);
+}
+
+// Wait for thread tid, made by this one with clone(), to
+// exit. Return 0, or -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  if(tid <= 0 || reap(addr, 1, tid) < 0)
+    return -1;
+  return 0;
+}
+
+// Run p on this CPU until it gives the CPU back, and charge
+// the time to its time slice. A process that blocks before
+// using up its slice is likely waiting for a person or a
+// device, so it gets a boost: it runs ahead of the others
+// until it uses up a slice.
+// Caller must hold p->lock.
+static void
+run(struct cpu *c, struct proc *p)
+{
+  uint64 start, used;
+
+  // It is the process's job to release its lock and
+  // then reacquire it before jumping back to us.
+  p->state = RUNNING;
+  c->proc = p;
+  c->idle = 0;
+  __sync_synchronize();
+  STATINC(switches);
+
+  // the rest of the process's time slice.
+  start = r_time();
+  c->sliceend = start + p->sliceleft;
+  timerset();
+
+  // run on the process's kernel page table, so that
+  // copyin() can use the MMU to reach user memory.
+  mmswitch(p);
+
+  swtch(&c->context, &p->context);
+
+  // back to the global kernel page table.
+  kvmswitch(kernel_pagetable, 0);
+
+  // Process is done running for now.
+  // It should have changed its p->state before coming back.
+  c->proc = 0;
+  c->sliceend = 0;
+
+  used = r_time() - start;
+  if(p->state == SLEEPING && used < p->sliceleft){
+    p->sliceleft -= used;
+    if(!p->boost)
+      STATINC(boosts);
+    p->boost = 1;
+  } else {
+    p->sliceleft = p->quantum;
+    p->boost = 0;
   }
 }
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, boosted ones first.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -458,32 +1055,33 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int pass;
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
+
+    // from here on, a CPU that makes a process RUNNABLE
+    // interrupts this one (see kickidle()), so the wfi
+    // below can't miss it.
+    c->idle = 1;
     
     int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        found = 1;
+    for(pass = 0; pass < 2; pass++){
+      for(p = proc; p < &proc[NPROC]; p++) {
+        acquire(&p->lock);
+        if(p->state == RUNNABLE && (p->boost || pass == 1)) {
+          run(c, p);
+          found = 1;
+        }
+        release(&p->lock);
       }
-      release(&p->lock);
     }
     if(found == 0) {
+      // sleep until a device, a timer event, or another
+      // CPU interrupts.
+      timerset();
       intr_on();
       asm volatile("wfi");
     }
@@ -522,6 +1120,7 @@ void
 yield(void)
 {
   struct proc *p = myproc();
+  STATINC(yields);
   acquire(&p->lock);
   p->state = RUNNABLE;
   sched();
@@ -549,6 +1148,33 @@ forkret(void)
   usertrapret();
 }
 
+// A spawn()ed child's very first scheduling by scheduler()
+// will swtch to spawnret, which execs the program and tells
+// the parent how that went.
+static void
+spawnret(void)
+{
+  struct proc *p = myproc();
+  int argc;
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  argc = exec(p->spawnpath, p->spawnargv);
+
+  acquire(&wait_lock);
+  p->spawnres = argc < 0 ? -1 : 1;
+  p->spawnpath = 0;
+  p->spawnargv = 0;
+  wakeup(p);
+  release(&wait_lock);
+
+  if(argc < 0)
+    exit(-1);
+  p->trapframe->a0 = argc;
+  usertrapret();
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -587,16 +1213,44 @@ sleep(void *chan, struct spinlock *lk)
 // Must be called without any p->lock.
 void
 wakeup(void *chan)
+{
+  wakeupn(chan, NPROC);
+}
+
+// Wake up at most n processes sleeping on chan, and
+// return how many.
+// Must be called without any p->lock.
+int
+wakeupn(void *chan, int n)
 {
   struct proc *p;
+  int woke = 0;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(p = proc; p < &proc[NPROC] && woke < n; p++) {
     acquire(&p->lock);
     if(p->state == SLEEPING && p->chan == chan) {
       p->state = RUNNABLE;
+      woke++;
     }
     release(&p->lock);
   }
+  if(woke)
+    kickidle();
+  return woke;
+}
+
+// Wake up p if it is sleeping on chan, without looking
+// at any other process.
+// Must be called without p->lock.
+void
+wakeproc(struct proc *p, void *chan)
+{
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan) {
+    p->state = RUNNABLE;
+    kickidle();
+  }
+  release(&p->lock);
 }
 
 // Wake up p if it is sleeping in wait(); used by exit().
@@ -608,31 +1262,55 @@ wakeup1(struct proc *p)
     panic("wakeup1");
   if(p->chan == p && p->state == SLEEPING) {
     p->state = RUNNABLE;
+    kickidle();
   }
 }
 
-// Kill the process with the given pid.
-// The victim won't exit until it tries to return
+// Kill the process with the given pid, and the other
+// threads of its address space.
+// The victims won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
 int
 kill(int pid)
 {
   struct proc *p;
+  struct mm *mm = 0;
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
+      mm = p->mm;
+      killproc(p);
       release(&p->lock);
-      return 0;
+      break;
     }
     release(&p->lock);
   }
-  return -1;
+  if(p == &proc[NPROC])
+    return -1;
+
+  // and the rest of its threads.
+  for(p = proc; mm != 0 && p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->mm == mm)
+      killproc(p);
+    release(&p->lock);
+  }
+  return 0;
+}
+
+// Mark p killed, waking it if it is asleep; it exits the
+// next time it would return to user space.
+// Caller must hold p->lock.
+static void
+killproc(struct proc *p)
+{
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    p->state = RUNNABLE;
+    kickidle();
+  }
 }
 
 // Copy to either a user address, or kernel address,
@@ -665,6 +1343,54 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
   }
 }
 
+// Called before changing the mappings in pagetable.
+// If pagetable is the running process's user or kernel page
+// table, bumps p->mm->tlbgen, so that CPUs that ran it earlier
+// flush its ASIDs before running it again, and returns the ASID
+// for sfence_vma_page() on this CPU. Otherwise returns -1: the
+// page table is not in use, or it is a new one for exec, which
+// calls mmswitch().
+int
+asidbegin(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || p->mm == 0)
+    return -1;
+  if(pagetable == p->pagetable){
+    __sync_fetch_and_add(&p->mm->tlbgen, 1);
+    return p->mm->asid;
+  }
+  if(pagetable == p->kpagetable){
+    __sync_fetch_and_add(&p->mm->tlbgen, 1);
+    return p->mm->kasid;
+  }
+  return -1;
+}
+
+// Called after changing mappings, with asidbegin()'s result.
+// This CPU flushed each changed page, or all of the ASIDs if
+// p moved here in the middle, so its TLB is now up to date,
+// unless another thread changed mappings at the same time:
+// then the next mmswitch() here flushes.
+void
+asidend(int asid)
+{
+  struct mm *mm;
+  struct cpu *c;
+  uint64 gen;
+
+  if(asid < 0)
+    return;
+  push_off();
+  c = mycpu();
+  mm = c->proc->mm;
+  gen = mm->tlbgen;
+  if(c->tlbgen[mm - mmtab] == gen - 1)
+    c->tlbgen[mm - mmtab] = gen;
+  pop_off();
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -24,6 +24,12 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 tlbgen[NPROC];       // mmtab[i].tlbgen as of this TLB's last flush of its ASIDs
+  uint64 sliceend;            // When the running process's time slice ends; 0 if none.
+  uint64 timer;               // When this CPU's timer will fire; ~0 if disarmed.
+  uint64 profnext;            // When to take the next profiler sample.
+  int idle;                   // Looking for a process to run? (see kickidle())
+  int ucopy;                  // In ucopy.S? A load fault there makes it return -1.
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,6 +86,57 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A region of user memory [start, end) that is filled in on
+// demand (see vma.c): a program segment, or an mmap()ed file.
+// The first filesz bytes come from ip, starting at offset off;
+// the rest are zeros.
+struct vma {
+  uint64 start;                // page-aligned; unused if start == end
+  uint64 end;                  // page-aligned
+  int perm;                    // PTE_R, PTE_W and PTE_X
+  int flags;                   // VMA_*
+  struct inode *ip;            // file, or 0 for zeros only
+  uint off;
+  uint filesz;
+};
+
+#define VMA_MMAP    1   // made by mmap(), not exec()
+#define VMA_SHARED  2   // stores go to the file
+
+// A user address space: user memory, the user page table, and
+// the kernel page table that mirrors it. Shared by the threads
+// of a process (see clone()); p->pagetable, p->kpagetable and
+// p->ring cache the ones of p->mm, which never change.
+struct mm {
+  struct spinlock lock;        // held while changing mappings or the fields below
+  int ref;                     // procs using it, including zombies
+  int nlive;                   // of those, ones that haven't exited
+  struct proc *leader;         // the thread that isn't a clone(); its exit() ends the rest
+  struct proc *killer;         // thread killing the others to exit() or exec(), or 0
+  int ringbusy;                // a thread is in ringenter()
+  uint64 sz;                   // Size of process memory (bytes)
+  pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, mirroring user memory
+  int asid;                    // ASID for pagetable; 0 without ASIDs
+  int kasid;                   // ASID for kpagetable; 0 without ASIDs
+  uint64 tlbgen;               // Bumped whenever mappings change
+  struct sysring *ring;        // batched syscall ring, at USYSRING
+  struct vma vma[NVMA];        // demand-paged segments and mmap()ed files
+};
+
+extern struct mm mmtab[NPROC];
+
+// Open files and current directory, shared by the threads of
+// a process (see clone()) as their struct mm is.
+struct files {
+  struct spinlock lock;        // held while using the fields below
+  int ref;                     // procs using it
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
+extern struct files filestab[NPROC];
+
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -88,19 +145,39 @@ struct proc {
 
   // p->lock must be held when using these:
   enum procstate state;        // Process state
-  struct proc *parent;         // Parent process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint64 sliceleft;            // Unused part of the time slice
+  int boost;                   // Blocked early; scheduled ahead of others
+
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process, or creating thread
+  struct proc *children;       // Live children, through sibnext/sibprev
+  struct proc *zombies;        // Exited children not yet waited for
+  struct proc *sibnext;        // Circular list in parent's children or zombies
+  struct proc *sibprev;
+  int thread;                  // made by clone(); reaped by join(), not wait()
+  int spawnres;                // spawn(): 0 until the child's exec() is done, then 1 or -1
+
+  // sleeptimer.lock (timer.c) must be held when using these:
+  uint64 deadline;             // Wake-up time, in timersleep()
+  int heapidx;                 // Index in the sleep heap, or 0
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  uint64 quantum;              // Time slice, in time CSR units
+  struct mm *mm;               // Address space, maybe shared with other threads
+  pagetable_t pagetable;       // mm->pagetable
+  pagetable_t kpagetable;      // mm->kpagetable
+  struct sysring *ring;        // mm->ring
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 trapva;               // where trapframe is mapped in pagetable
+  char *spawnpath;             // spawn(): program for spawnret() to exec()
+  char **spawnargv;
+  int nsleeplock;               // Sleep-locks held, so vmfault() mustn't read files
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct files *files;         // Open files and cwd, maybe shared with other threads
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,117 @@
+//
+// Sampling profiler.
+//
+// While profiling is on, every CPU's timer interrupt records the
+// interrupted pc, whether it was in user or kernel mode, and the
+// running process, in a per-CPU ring. profread() drains the
+// rings; user/prof.c aggregates the samples, and prof-symbolize
+// turns the pcs into function names on the host.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NPROFBUF 1024  // samples per CPU
+
+struct profbuf {
+  struct spinlock lock;
+  struct profsample buf[NPROFBUF];
+  uint nwrite;   // number of samples recorded
+  uint nread;    // number of samples read
+  uint ndrop;    // samples lost because the ring was full
+} profbuf[NCPU];
+
+int profiling;
+
+void
+profinit(void)
+{
+  for(int i = 0; i < NCPU; i++)
+    initlock(&profbuf[i].lock, "prof");
+}
+
+// Record a sample for this CPU's timer interrupt.
+// Called from devintr(), with interrupts off.
+void
+profsample(uint64 pc, int user)
+{
+  struct profbuf *b;
+  struct profsample *s;
+  struct proc *p;
+
+  if(!profiling)
+    return;
+
+  b = &profbuf[cpuid()];
+  acquire(&b->lock);
+  if(b->nwrite == b->nread + NPROFBUF){
+    b->ndrop++;
+  } else {
+    s = &b->buf[b->nwrite++ % NPROFBUF];
+    p = myproc();
+    s->pc = pc;
+    s->user = user;
+    s->pid = p ? p->pid : 0;
+    safestrcpy(s->name, p ? p->name : "idle", sizeof(s->name));
+  }
+  release(&b->lock);
+}
+
+// Turn profiling on (discarding old samples) or off.
+void
+profctl(int on)
+{
+  if(on){
+    for(int i = 0; i < NCPU; i++){
+      acquire(&profbuf[i].lock);
+      profbuf[i].nread = profbuf[i].nwrite = 0;
+      profbuf[i].ndrop = 0;
+      release(&profbuf[i].lock);
+    }
+  }
+  profiling = on;
+}
+
+// Move up to n samples, from all CPUs, to user address addr.
+// Returns the number of samples copied, or -1 on error.
+int
+profread(uint64 addr, int n)
+{
+  struct profsample *tmp;
+  struct profbuf *b;
+  int m, tot;
+
+  // copy through a kernel page, since copyout() may
+  // not be called with a spinlock held.
+  if((tmp = (struct profsample *)kalloc()) == 0)
+    return -1;
+
+  tot = 0;
+  for(b = profbuf; b < &profbuf[NCPU] && tot < n; b++){
+    for(;;){
+      acquire(&b->lock);
+      for(m = 0; m < PGSIZE/sizeof(*tmp) && tot + m < n; m++){
+        if(b->nread == b->nwrite)
+          break;
+        tmp[m] = b->buf[b->nread++ % NPROFBUF];
+      }
+      release(&b->lock);
+      if(m == 0)
+        break;
+      if(copyout(myproc()->pagetable, addr, (char *)tmp, m*sizeof(*tmp)) < 0){
+        kfree(tmp);
+        return -1;
+      }
+      addr += m*sizeof(*tmp);
+      tot += m;
+    }
+  }
+  kfree(tmp);
+  return tot;
+}
@@ -0,0 +1,8 @@
+// Samples recorded by the timer-interrupt profiler (prof.c),
+// and read by profread().
+struct profsample {
+  uint64 pc;      // interrupted program counter
+  int pid;        // running process, or 0 if the CPU was idle
+  int user;       // 1 if pc is a user address, 0 if kernel
+  char name[16];  // running process's name, for user symbols
+};
@@ -1,6 +1,10 @@
 //
 // ramdisk that uses the disk image loaded by qemu -initrd fs.img
 //
+// make DISK=ram qemu boots with the file system in RAM, so that
+// file system and buffer cache benchmarks measure CPU cost
+// without virtio and qemu disk emulation in the way.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -15,17 +19,23 @@
 void
 ramdiskinit(void)
 {
+  struct superblock *sb = (struct superblock *)(RAMDISK + BSIZE);
+
+  // qemu leaves RAMDISK untouched if there was no -initrd.
+  if(sb->magic != FSMAGIC)
+    panic("ramdiskinit: no file system image at RAMDISK");
+
+  // connect bread() and bwrite() to ramdiskrw.
+  bdevsw[RAM_DISK].rw = ramdiskrw;
 }
 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Copy b->data to or from the in-memory disk image.
+// Completes synchronously, so there is no interrupt.
 void
-ramdiskrw(struct buf *b)
+ramdiskrw(struct buf *b, int write)
 {
   if(!holdingsleep(&b->lock))
     panic("ramdiskrw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("ramdiskrw: nothing to do");
 
   if(b->blockno >= FSSIZE)
     panic("ramdiskrw: blockno too big");
@@ -33,13 +43,9 @@ ramdiskrw(struct buf *b)
   uint64 diskaddr = b->blockno * BSIZE;
   char *addr = (char *)RAMDISK + diskaddr;
 
-  if(b->flags & B_DIRTY){
-    // write
+  if(write){
     memmove(addr, b->data, BSIZE);
-    b->flags &= ~B_DIRTY;
   } else {
-    // read
     memmove(b->data, addr, BSIZE);
-    b->flags |= B_VALID;
   }
 }
@@ -8,6 +8,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sleeplock.h"
+#include "stats.h"
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
@@ -15,18 +16,56 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->owner = 0;
+  lk->nwait = 0;
   lk->pid = 0;
 }
 
+// Wait for the lock without sleeping, for at most SLSPIN
+// time CSR units, while its owner is running on another
+// CPU: critical sections like bget()'s and ilock()'s are
+// usually over sooner than a sleep and wakeup would take.
+// Returns with lk->lk held again.
+static void
+spinsleep(struct sleeplock *lk)
+{
+  struct proc *owner;
+  uint64 end = r_time() + SLSPIN;
+
+  while(lk->locked && (owner = lk->owner) != 0 && r_time() < end){
+    release(&lk->lk);
+    while(*(volatile uint*)&lk->locked &&
+          *(volatile enum procstate*)&owner->state == RUNNING &&
+          r_time() < end)
+      ;
+    acquire(&lk->lk);
+    if(lk->locked && lk->owner == owner && owner->state != RUNNING)
+      break;
+  }
+}
+
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  STATINC(slacquire);
+  if(lk->locked){
+    spinsleep(lk);
+    if(lk->locked){
+      STATINC(slslept);
+      lk->nwait++;
+      while (lk->locked) {
+        sleep(lk, &lk->lk);
+      }
+      lk->nwait--;
+    } else {
+      STATINC(slspun);
+    }
   }
   lk->locked = 1;
-  lk->pid = myproc()->pid;
+  lk->owner = myproc();
+  lk->pid = lk->owner->pid;
+  lk->owner->nsleeplock++;
   release(&lk->lk);
 }
 
@@ -34,9 +73,13 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  if(lk->owner)
+    lk->owner->nsleeplock--;
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
-  wakeup(lk);
+  if(lk->nwait > 0)
+    wakeup(lk);
   release(&lk->lk);
 }
 
@@ -10,10 +10,10 @@ void timerinit();
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
-// scratch area for timer interrupt, one per CPU.
+// scratch area for machine-mode traps, one per CPU.
 uint64 mscratch0[NCPU * 32];
 
-// assembly code in kernelvec.S for machine-mode timer interrupt.
+// assembly code in kernelvec.S for machine-mode traps.
 extern void timervec();
 
 // entry.S jumps here in machine mode on stack0.
@@ -33,14 +33,23 @@ start()
   // disable paging for now.
   w_satp(0);
 
-  // delegate all interrupts and exceptions to supervisor mode.
-  w_medeleg(0xffff);
+  // delegate all interrupts and exceptions to supervisor mode,
+  // except ecalls from supervisor mode, which are how the
+  // kernel asks machine mode to set the timer or interrupt
+  // another CPU.
+  w_medeleg(0xffff & ~(1 << 9));
   w_mideleg(0xffff);
   w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
-  // ask for clock interrupts.
+  // set up the timer and inter-CPU interrupts.
   timerinit();
 
+  // let supervisor and user code read the cycle and time
+  // CSRs with rdcycle and rdtime, for cheap timestamps in
+  // benchmarks.
+  w_mcounteren(r_mcounteren() | 1 | 2);
+  w_scounteren(r_scounteren() | 1 | 2);
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -49,27 +58,29 @@ start()
   asm volatile("mret");
 }
 
-// set up to receive timer interrupts in machine mode,
-// which arrive at timervec in kernelvec.S,
-// which turns them into software interrupts for
-// devintr() in trap.c.
+// set up to receive timer and software interrupts in machine
+// mode, which arrive at timervec in kernelvec.S, which turns
+// them into software interrupts for devintr() in trap.c.
+// the timer is one-shot; the kernel programs it for each
+// next event (see timer.c).
 void
 timerinit()
 {
   // each CPU has a separate source of timer interrupts.
   int id = r_mhartid();
 
-  // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  // nothing to do until the kernel asks.
+  *(uint64*)CLINT_MTIMECMP(id) = -1;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..3] : space for timervec to save registers.
   // scratch[4] : address of CLINT MTIMECMP register.
-  // scratch[5] : desired interval (in cycles) between timer interrupts.
+  // scratch[5] : address of CLINT MSIP register.
+  // scratch[6] : address of the CLINT, for other CPUs' MSIP.
   uint64 *scratch = &mscratch0[32 * id];
   scratch[4] = CLINT_MTIMECMP(id);
-  scratch[5] = interval;
+  scratch[5] = CLINT_MSIP(id);
+  scratch[6] = CLINT;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -78,6 +89,6 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer and software interrupts.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
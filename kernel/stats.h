@@ -0,0 +1,10 @@
+// Kernel event counters, for performance tuning, copied
+// to user space by stats().
+struct stats {
+  uint64 slacquire;   // acquiresleep() calls
+  uint64 slspun;      // of those, got the lock by spinning
+  uint64 slslept;     // of those, slept at least once
+  uint64 switches;    // processes run by the scheduler
+  uint64 yields;      // of those, preempted at the end of a time slice
+  uint64 boosts;      // of those, blocked early and so got boosted
+};
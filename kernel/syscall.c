@@ -12,7 +12,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
+  if(addr >= p->mm->sz || addr+sizeof(uint64) > p->mm->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -104,6 +104,21 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_ringenter(void);
+extern uint64 sys_profile(void);
+extern uint64 sys_profread(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_stats(void);
+extern uint64 sys_setquantum(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_spawn(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -127,6 +142,21 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_ringenter] sys_ringenter,
+[SYS_profile] sys_profile,
+[SYS_profread] sys_profread,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_stats]   sys_stats,
+[SYS_setquantum] sys_setquantum,
+[SYS_getdents] sys_getdents,
+[SYS_sendfile] sys_sendfile,
+[SYS_spawn]   sys_spawn,
 };
 
 void
@@ -20,3 +20,18 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_ringenter 22
+#define SYS_profile 23
+#define SYS_profread 24
+#define SYS_mmap   25
+#define SYS_munmap 26
+#define SYS_nanosleep 27
+#define SYS_clone  28
+#define SYS_join   29
+#define SYS_futex_wait 30
+#define SYS_futex_wake 31
+#define SYS_stats  32
+#define SYS_setquantum 33
+#define SYS_getdents 34
+#define SYS_sendfile 35
+#define SYS_spawn  36
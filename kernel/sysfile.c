@@ -15,23 +15,53 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "sysring.h"
+
+// Return the file open as fd, with a reference for the
+// caller to fileclose(): another thread may close fd
+// while the caller uses the file.
+static struct file*
+fdget(int fd)
+{
+  struct files *fs = myproc()->files;
+  struct file *f = 0;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&fs->lock);
+  if((f = fs->ofile[fd]) != 0)
+    filedup(f);
+  release(&fs->lock);
+  return f;
+}
+
+// Free fd, and return the file that was open as fd, whose
+// reference passes to the caller, or 0 if none was.
+static struct file*
+fdclose(int fd)
+{
+  struct files *fs = myproc()->files;
+  struct file *f = 0;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&fs->lock);
+  f = fs->ofile[fd];
+  fs->ofile[fd] = 0;
+  release(&fs->lock);
+  return f;
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return the corresponding struct file, with a reference that
+// the caller must drop with fileclose().
 static int
-argfd(int n, int *pfd, struct file **pf)
+argfd(int n, struct file **pf)
 {
   int fd;
-  struct file *f;
 
-  if(argint(n, &fd) < 0)
-    return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(argint(n, &fd) < 0 || (*pf = fdget(fd)) == 0)
     return -1;
-  if(pfd)
-    *pfd = fd;
-  if(pf)
-    *pf = f;
   return 0;
 }
 
@@ -41,14 +71,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct files *fs = myproc()->files;
 
+  acquire(&fs->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(fs->ofile[fd] == 0){
+      fs->ofile[fd] = f;
+      release(&fs->lock);
       return fd;
     }
   }
+  release(&fs->lock);
   return -1;
 }
 
@@ -58,11 +91,12 @@ sys_dup(void)
   struct file *f;
   int fd;
 
-  if(argfd(0, 0, &f) < 0)
+  if(argfd(0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -70,25 +104,28 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, &f) < 0)
     return -1;
-
-  return filewrite(f, p, n);
+  r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
@@ -97,9 +134,8 @@ sys_close(void)
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(0, &fd) < 0 || (f = fdclose(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -109,10 +145,49 @@ sys_fstat(void)
 {
   struct file *f;
   uint64 st; // user pointer to struct stat
+  int r;
+
+  if(argaddr(1, &st) < 0 || argfd(0, &f) < 0)
+    return -1;
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
+}
+
+// getdents(fd, buf, n) reads up to n entries of directory
+// fd, with their types, into the struct direntry array buf.
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  uint64 addr;
+  int n, r;
 
-  if(argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
+  if(argaddr(1, &addr) < 0 || argint(2, &n) < 0 || argfd(0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filereaddir(f, addr, n);
+  fileclose(f);
+  return r;
+}
+
+// sendfile(out, in, n) copies up to n bytes from file fd
+// in, at its offset, to fd out inside the kernel.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n, r;
+
+  if(argint(2, &n) < 0 || n < 0 || argfd(0, &out) < 0)
+    return -1;
+  if(argfd(1, &in) < 0){
+    fileclose(out);
+    return -1;
+  }
+  r = filesend(out, in, n);
+  fileclose(in);
+  fileclose(out);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -322,6 +397,13 @@ sys_open(void)
     return -1;
   }
 
+  // running programs map their text from the page cache.
+  if(ip->ntext > 0 && (omode & (O_WRONLY|O_RDWR|O_TRUNC))){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
@@ -391,8 +473,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct files *fs = myproc()->files;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -406,25 +488,36 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  acquire(&fs->lock);
+  old = fs->cwd;
+  fs->cwd = ip;
+  release(&fs->lock);
+  iput(old);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Copy the user argument vector at uargv into argv, which
+// has room for MAXARG pointers, a page per string.
+// Returns 0, or -1 with argv freed.
+static int
+fetchargv(uint64 uargv, char **argv)
+{
+  int i;
+  uint64 uarg;
+
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -440,18 +533,47 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = exec(path, argv);
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
 
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv) is fork() then exec(path, argv) in the
+// child, without copying this process's memory.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  ret = spawn(path, argv);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -469,18 +591,134 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdclose(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdclose(fd0);
+    fdclose(fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+// void *mmap(void *addr, int len, int prot, int flags, int fd, int off)
+// addr is only a hint, and ignored.
+uint64
+sys_mmap(void)
+{
+  uint64 addr;
+  int len, prot, flags, off;
+  struct file *f;
+  uint64 r;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || argfd(4, &f) < 0)
+    return -1;
+  r = mmap(f, len, prot, flags, off);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  if(len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// Carry out one ring submission, as the equivalent
+// system call would, and return its result.
+static int
+ringop(struct ringsqe *e)
+{
+  struct file *f;
+  int r;
+
+  if(e->op == RING_CLOSE){
+    if((f = fdclose(e->fd)) == 0)
+      return -1;
+    fileclose(f);
+    return 0;
+  }
+  if((f = fdget(e->fd)) == 0)
+    return -1;
+
+  switch(e->op){
+  case RING_READ:
+    r = fileread(f, e->addr, e->n);
+    break;
+  case RING_WRITE:
+    r = filewrite(f, e->addr, e->n);
+    break;
+  case RING_FSTAT:
+    r = filestat(f, e->addr);
+    break;
+  default:
+    r = -1;
+  }
+  fileclose(f);
+  return r;
+}
+
+// Process up to n queued submissions from the ring at
+// USYSRING, posting a completion for each, in order.
+// Stops early if the submission queue is empty or the
+// completion queue is full.
+// Returns the number of submissions consumed.
+uint64
+sys_ringenter(void)
+{
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  struct sysring *r = p->ring;
+  struct ringsqe e;
+  int n, done, res;
+
+  if(argint(0, &n) < 0)
+    return -1;
+
+  // the threads share the ring; one at a time.
+  acquire(&mm->lock);
+  while(mm->ringbusy){
+    if(p->killed){
+      release(&mm->lock);
+      return -1;
+    }
+    sleep(&mm->ringbusy, &mm->lock);
+  }
+  mm->ringbusy = 1;
+  release(&mm->lock);
+
+  for(done = 0; done < n && !p->killed; done++){
+    if(r->sqhead == r->sqtail || r->cqtail - r->cqhead >= NRING)
+      break;
+    // copy the entry out first: user code can rewrite
+    // the ring at any time.
+    e = r->sq[r->sqhead % NRING];
+    r->sqhead++;
+    res = ringop(&e);
+    r->cq[r->cqtail % NRING].tag = e.tag;
+    r->cq[r->cqtail % NRING].res = res;
+    r->cqtail++;
+  }
+
+  acquire(&mm->lock);
+  mm->ringbusy = 0;
+  release(&mm->lock);
+  wakeup(&mm->ringbusy);
+  return done;
+}
@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "stats.h"
 
 uint64
 sys_exit(void)
@@ -38,39 +39,89 @@ sys_wait(void)
   return wait(p);
 }
 
+// clone(fn, arg, stack) starts a thread running fn(arg) on
+// stack, in the caller's address space.
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return join(tid, p);
+}
+
+// futex_wait(addr, val) sleeps until futex_wake(addr),
+// if *addr is still val.
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+// futex_wake(addr, n) wakes up to n futex_wait()ers on addr.
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
 uint64
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  if(n < 0)
+    n = 0;
+  return timersleep(r_time() + (uint64)n * TICK);
+}
+
+// nanosleep(ns): sleep for at least ns nanoseconds, to the
+// resolution of the time CSR.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns, t;
+
+  if(argaddr(0, &ns) < 0)
+    return -1;
+  if(ns > (1L << 60))
+    ns = 1L << 60;
+  t = (ns * (TIMEFREQ / 1000000) + 999) / 1000;
+  return timersleep(r_time() + t);
 }
 
 uint64
@@ -83,15 +134,73 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
+// profile(1) starts the sampling profiler, discarding old
+// samples; profile(0) stops it.
+uint64
+sys_profile(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  profctl(on != 0);
+  return 0;
+}
+
+// profread(buf, n) moves up to n struct profsample to buf,
+// and returns how many it moved.
+uint64
+sys_profread(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return profread(addr, n);
+}
+
+// setquantum(us) sets the calling process's time slice, which
+// its children inherit, to us microseconds if us > 0, and
+// returns the old one. Longer slices favour throughput,
+// shorter ones response time.
+uint64
+sys_setquantum(void)
+{
+  struct proc *p = myproc();
+  uint64 old;
+  int us;
+
+  if(argint(0, &us) < 0)
+    return -1;
+  old = p->quantum / (TIMEFREQ/1000000);
+  if(us > 0){
+    if(us < 100)
+      us = 100;
+    acquire(&p->lock);
+    p->quantum = (uint64)us * (TIMEFREQ/1000000);
+    if(p->sliceleft > p->quantum)
+      p->sliceleft = p->quantum;
+    release(&p->lock);
+  }
+  return old;
+}
+
+// stats(st) copies the kernel's event counters to st.
+uint64
+sys_stats(void)
+{
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  return copyout(myproc()->pagetable, addr, (char*)&stats, sizeof(stats));
+}
+
+// return how many clock ticks have passed
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
-
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  return uptime();
 }
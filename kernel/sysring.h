@@ -0,0 +1,36 @@
+// Shared submission/completion ring for ringenter().
+//
+// Each process has one page mapped at USYSRING (see memlayout.h).
+// User code fills sq[sqtail % NRING] and advances sqtail;
+// ringenter(n) carries out up to n queued submissions, in order,
+// and posts a completion for each at cq[cqtail % NRING].
+// User code consumes completions by advancing cqhead.
+
+#define RING_READ   1   // read(fd, addr, n)
+#define RING_WRITE  2   // write(fd, addr, n)
+#define RING_CLOSE  3   // close(fd)
+#define RING_FSTAT  4   // fstat(fd, addr)
+
+#define NRING      64   // entries per queue; a power of two
+
+struct ringsqe {
+  int op;        // RING_*
+  int fd;
+  uint64 addr;   // user buffer, for READ, WRITE and FSTAT
+  int n;         // byte count, for READ and WRITE
+  int tag;       // copied to the completion, for the caller's use
+};
+
+struct ringcqe {
+  int tag;
+  int res;       // what the equivalent system call would return
+};
+
+struct sysring {
+  uint sqhead;   // next submission the kernel will take
+  uint sqtail;   // one past the last submission; written by user
+  uint cqhead;   // next completion user will take; written by user
+  uint cqtail;   // one past the last completion
+  struct ringsqe sq[NRING];
+  struct ringcqe cq[NRING];
+};
@@ -0,0 +1,237 @@
+//
+// Tickless timers.
+//
+// Each CPU's timer is one-shot, programmed for the next event
+// that CPU needs: the end of the running process's time slice,
+// the earliest sleep() deadline if this CPU is the one watching
+// it, or the next profiler sample. Sleeping processes are kept
+// in a min-heap by deadline, so a timer interrupt wakes just
+// the ones whose deadlines have passed. An idle CPU with none of
+// these waits in wfi with its timer off, and another CPU that
+// makes a process RUNNABLE interrupts it with kickidle().
+//
+// Supervisor mode can't reach the CLINT, so timerset() and
+// kickidle() ecall to timervec in kernelvec.S, which runs in
+// machine mode.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define MCALL_TIMER 0   // fire this CPU's timer at time arg
+#define MCALL_IPI   1   // interrupt CPU arg
+
+// The processes in timersleep(), in a min-heap on
+// p->deadline, and the CPU whose timer watches for the
+// earliest deadline. A process that becomes the earliest
+// makes its own CPU the watcher.
+struct {
+  struct spinlock lock;
+  struct proc *heap[NPROC+1];  // heap[1..n]; p->heapidx is p's index
+  int n;
+  uint64 deadline;             // heap[1]->deadline, or ~0 if n == 0
+  int cpu;
+} sleeptimer;
+
+// Heap operations. Caller must hold sleeptimer.lock.
+
+static void
+heapput(int i, struct proc *p)
+{
+  sleeptimer.heap[i] = p;
+  p->heapidx = i;
+}
+
+static void
+siftup(int i)
+{
+  struct proc *p = sleeptimer.heap[i];
+
+  for(; i > 1 && sleeptimer.heap[i/2]->deadline > p->deadline; i /= 2)
+    heapput(i, sleeptimer.heap[i/2]);
+  heapput(i, p);
+}
+
+static void
+siftdown(int i)
+{
+  struct proc *p = sleeptimer.heap[i];
+  int c;
+
+  for(; (c = 2*i) <= sleeptimer.n; i = c){
+    if(c < sleeptimer.n && sleeptimer.heap[c+1]->deadline < sleeptimer.heap[c]->deadline)
+      c++;
+    if(sleeptimer.heap[c]->deadline >= p->deadline)
+      break;
+    heapput(i, sleeptimer.heap[c]);
+  }
+  heapput(i, p);
+}
+
+static void
+heapinsert(struct proc *p)
+{
+  sleeptimer.n++;
+  heapput(sleeptimer.n, p);
+  siftup(sleeptimer.n);
+  sleeptimer.deadline = sleeptimer.heap[1]->deadline;
+}
+
+static void
+heapremove(struct proc *p)
+{
+  int i = p->heapidx;
+  struct proc *last = sleeptimer.heap[sleeptimer.n--];
+
+  p->heapidx = 0;
+  if(last != p){
+    heapput(i, last);
+    siftup(i);
+    siftdown(last->heapidx);
+  }
+  sleeptimer.deadline = sleeptimer.n ? sleeptimer.heap[1]->deadline : ~0;
+}
+
+static void
+mcall(uint64 fn, uint64 arg)
+{
+  register uint64 a0 asm("a0") = arg;
+  register uint64 a7 asm("a7") = fn;
+
+  asm volatile("ecall" : "+r" (a0) : "r" (a7) : "memory");
+}
+
+void
+timersinit(void)
+{
+  initlock(&sleeptimer.lock, "sleeptimer");
+  sleeptimer.deadline = ~0;
+  sleeptimer.cpu = -1;
+}
+
+// Program this CPU's timer for its next event.
+void
+timerset(void)
+{
+  struct cpu *c;
+  uint64 t = ~0;
+
+  push_off();
+  c = mycpu();
+  if(c->sliceend)
+    t = c->sliceend;
+  // read without sleeptimer.lock, which the caller may not
+  // take (the scheduler holds a p->lock). only this CPU
+  // makes itself the watcher, so a stale value can only
+  // cause a spurious interrupt.
+  if(sleeptimer.cpu == cpuid() && sleeptimer.deadline < t)
+    t = sleeptimer.deadline;
+  if(profiling && c->profnext < t)
+    t = c->profnext;
+  if(t != c->timer){
+    c->timer = t;
+    mcall(MCALL_TIMER, t);
+  }
+  pop_off();
+}
+
+// Sleep until the time CSR reaches deadline.
+// Returns -1 if killed first, otherwise 0.
+int
+timersleep(uint64 deadline)
+{
+  struct proc *p = myproc();
+
+  acquire(&sleeptimer.lock);
+  while(r_time() < deadline){
+    if(p->killed){
+      release(&sleeptimer.lock);
+      return -1;
+    }
+    p->deadline = deadline;
+    heapinsert(p);
+    if(sleeptimer.heap[1] == p){
+      // the scheduler arms this CPU's timer once
+      // this process is asleep.
+      sleeptimer.cpu = cpuid();
+    }
+    sleep(&p->deadline, &sleeptimer.lock);
+    if(p->heapidx)
+      heapremove(p);  // woken early, by kill()
+  }
+  release(&sleeptimer.lock);
+  return 0;
+}
+
+// A supervisor software interrupt: this CPU's timer fired,
+// or another CPU kicked it. Called from devintr() with
+// interrupts off.
+// Returns 2 if the running process's time slice is over,
+// otherwise 1.
+int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *p;
+  uint64 now = r_time();
+  int which = 1;
+
+  // timervec disarmed the timer if it fired.
+  c->timer = ~0;
+
+  if(sleeptimer.cpu == cpuid() && now >= sleeptimer.deadline){
+    acquire(&sleeptimer.lock);
+    while(sleeptimer.n > 0 && sleeptimer.heap[1]->deadline <= now){
+      p = sleeptimer.heap[1];
+      heapremove(p);
+      wakeproc(p, &p->deadline);
+    }
+    release(&sleeptimer.lock);
+  }
+
+  if(profiling && now >= c->profnext){
+    profsample(r_sepc(), (r_sstatus() & SSTATUS_SPP) == 0);
+    c->profnext = now + TICK;
+  }
+
+  if(c->sliceend && now >= c->sliceend){
+    // a new slice in case the process doesn't yield,
+    // e.g. if it is on its way to sleep.
+    c->sliceend = now + TICK;
+    which = 2;
+  }
+
+  timerset();
+  return which;
+}
+
+// Interrupt an idle CPU, if there is one, so that it finds
+// a process just made RUNNABLE without waiting for a timer.
+void
+kickidle(void)
+{
+  int me;
+
+  push_off();
+  me = cpuid();
+  for(int i = 0; i < NCPU; i++){
+    if(i != me && cpus[i].idle){
+      cpus[i].idle = 0;
+      mcall(MCALL_IPI, i);
+      break;
+    }
+  }
+  pop_off();
+}
+
+// Time CSR ticks since boot.
+uint
+uptime(void)
+{
+  return r_time() / TICK;
+}
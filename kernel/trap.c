@@ -6,22 +6,14 @@
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
-uint ticks;
-
 extern char trampoline[], uservec[], userret[];
+extern char ucopyfault[];  // ucopy.S
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
 extern int devintr();
 
-void
-trapinit(void)
-{
-  initlock(&tickslock, "time");
-}
-
 // set up to take exceptions and traps while in the kernel.
 void
 trapinithart(void)
@@ -65,6 +57,12 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 && vmfault(p->pagetable, r_stval(), PTE_X) == 0){
+    // instruction page fault on demand-paged program text.
+  } else if(r_scause() == 13 && vmfault(p->pagetable, r_stval(), PTE_R) == 0){
+    // load page fault on a page not yet paged in.
+  } else if(r_scause() == 15 && vmfault(p->pagetable, r_stval(), PTE_W) == 0){
+    // store page fault on a page not yet paged in.
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -101,7 +99,7 @@ usertrapret(void)
 
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_satp = r_satp();         // kernel page table and ASID
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -119,13 +117,13 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  uint64 satp = MAKE_SATP(p->pagetable, p->mm->asid);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->trapva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,7 +141,11 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if(scause == 13 && mycpu()->ucopy){
+    // copyin_new() touched user memory that isn't mirrored;
+    // make it fail, and copyin() page it in.
+    sepc = (uint64)ucopyfault;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
@@ -159,15 +161,6 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
-clockintr()
-{
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
-}
-
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -201,18 +194,14 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000001L){
-    // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // software interrupt from a machine-mode timer or
+    // software interrupt, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    return timerintr();
   } else {
     return 0;
   }
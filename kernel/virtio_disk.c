@@ -110,6 +110,9 @@ virtio_disk_init(void)
     disk.free[i] = 1;
 
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+
+  // connect bread() and bwrite() to virtio_disk_rw.
+  bdevsw[VIRTIO_DISK].rw = virtio_disk_rw;
 }
 
 // find a free descriptor, mark it non-free, return its index.
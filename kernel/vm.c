@@ -11,6 +11,10 @@
  */
 pagetable_t kernel_pagetable;
 
+// does the MMU implement enough ASID bits to give every
+// process a user and a kernel ASID? (see procinit().)
+int useasids;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -30,6 +34,11 @@ kvminit()
   // virtio mmio disk interface
   kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+#ifdef RAMDISK_ROOT
+  // in-memory disk image
+  kvmmap(RAMDISK, RAMDISK, FSSIZE*BSIZE, PTE_R | PTE_W);
+#endif
+
   // CLINT
   kvmmap(CLINT, CLINT, 0x10000, PTE_R | PTE_W);
 
@@ -45,6 +54,111 @@ kvminit()
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+
+  // find out how many ASID bits the MMU implements, by writing
+  // ones to the satp ASID field and reading them back. paging
+  // is on for a moment, but the kernel is direct-mapped.
+  w_satp(MAKE_SATP(kernel_pagetable, 0xffff));
+  useasids = SATP_ASID(r_satp()) >= 2*NPROC;
+  w_satp(0);
+  sfence_vma();
+}
+
+// Create a kernel page table for a process. It shares the
+// kernel's mappings, except that the region below PLIC is
+// private, so that the process's user memory can be mapped
+// there (by kvmmapuser) for copyin_new() and copyinstr_new().
+// CLINT is left out; only machine mode uses it.
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate()
+{
+  pagetable_t kpagetable, low, klow;
+
+  if((kpagetable = (pagetable_t) kalloc()) == 0)
+    return 0;
+  if((low = (pagetable_t) kalloc()) == 0){
+    kfree(kpagetable);
+    return 0;
+  }
+  memset(low, 0, PGSIZE);
+
+  // level-2 entry 0 covers the devices and user memory;
+  // share the device mappings from PLIC up.
+  klow = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for(int i = PX(1, PLIC); i < 512; i++)
+    low[i] = klow[i];
+
+  // share everything else: kernel text and data, RAM,
+  // kernel stacks, and the trampoline.
+  kpagetable[0] = PA2PTE(low) | PTE_V;
+  for(int i = 1; i < 512; i++)
+    kpagetable[i] = kernel_pagetable[i];
+
+  return kpagetable;
+}
+
+// Free a page table made by kvmcreate(). Frees only the
+// private page-table pages, not the pages mapped by them,
+// which belong to the process's user page table.
+void
+kvmfree(pagetable_t kpagetable)
+{
+  pagetable_t low = (pagetable_t)PTE2PA(kpagetable[0]);
+
+  for(int i = 0; i < PX(1, PLIC); i++){
+    if(low[i] & PTE_V)
+      kfree((void*)PTE2PA(low[i]));
+  }
+  kfree((void*)low);
+  kfree((void*)kpagetable);
+}
+
+// Mirror the user mappings from oldsz to newsz of pagetable
+// in the process kernel page table kpagetable, without PTE_U
+// so that the kernel may use them. Pages that haven't been
+// faulted in yet are mirrored by vmfault() when they are.
+// Pages without PTE_U, like the stack guard page, are left
+// out, so that copyin_new() can't read them either.
+// Returns 0 on success, -1 if a page-table page couldn't be
+// allocated.
+int
+kvmmapuser(pagetable_t pagetable, pagetable_t kpagetable, uint64 oldsz, uint64 newsz)
+{
+  pte_t *pte, *kpte;
+  uint64 a;
+  int asid;
+
+  if(newsz > PLIC)
+    panic("kvmmapuser: too big");
+
+  asid = asidbegin(kpagetable);
+  for(a = PGROUNDUP(oldsz); a < newsz; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0 ||
+       (*pte & PTE_U) == 0)
+      continue;
+    if((kpte = walk(kpagetable, a, 1)) == 0){
+      asidend(asid);
+      kvmunmapuser(kpagetable, a, PGROUNDUP(oldsz));
+      return -1;
+    }
+    *kpte = *pte & ~PTE_U;
+    if(asid >= 0)
+      sfence_vma_page(a, asid);
+  }
+  asidend(asid);
+  return 0;
+}
+
+// Remove the kpagetable mirror of user memory from oldsz down
+// to newsz, leaving the pages themselves alone.
+void
+kvmunmapuser(pagetable_t kpagetable, uint64 oldsz, uint64 newsz)
+{
+  if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
+    uvmunmap(kpagetable, PGROUNDUP(newsz), npages, 0);
+  }
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -52,10 +166,23 @@ kvminit()
 void
 kvminithart()
 {
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
   sfence_vma();
 }
 
+// Switch to pagetable, with TLB entries tagged by asid.
+// The kernel page table is ASID 0 and never changes after
+// boot, and process page tables have ASIDs of their own
+// (see asidbegin()), so there is nothing to flush, unless
+// the MMU doesn't do ASIDs and everything is ASID 0.
+void
+kvmswitch(pagetable_t pagetable, int asid)
+{
+  w_satp(MAKE_SATP(pagetable, asid));
+  if(!useasids)
+    sfence_vma();
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -151,39 +278,48 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   uint64 a, last;
   pte_t *pte;
 
+  int asid = asidbegin(pagetable);
+
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if((pte = walk(pagetable, a, 1)) == 0){
+      asidend(asid);
       return -1;
+    }
     if(*pte & PTE_V)
       panic("remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
+    // the TLB may hold the old, invalid, PTE.
+    if(asid >= 0)
+      sfence_vma_page(a, asid);
     if(a == last)
       break;
     a += PGSIZE;
     pa += PGSIZE;
   }
+  asidend(asid);
   return 0;
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never faulted in (see
+// vma.c) are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  int asid;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
+  asid = asidbegin(pagetable);
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -191,7 +327,10 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       kfree((void*)pa);
     }
     *pte = 0;
+    if(asid >= 0)
+      sfence_vma_page(a, asid);
   }
+  asidend(asid);
 }
 
 // create an empty user page table.
@@ -302,27 +441,34 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
-// physical memory.
+// physical memory of [start, end), except that
+// read-only pages, such as program text, are shared,
+// as are all pages if share is set, and pages the
+// parent hasn't faulted in are left for the child
+// to fault in.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
   char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  for(i = start; i < end; i += PGSIZE){
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
+    if(share || (flags & PTE_W) == 0){
+      kref((void*)pa);
+      mem = (char*)pa;
+    } else {
+      if((mem = kalloc()) == 0)
+        goto err;
+      memmove(mem, (char*)pa, PGSIZE);
+    }
     if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
       kfree(mem);
       goto err;
@@ -331,7 +477,7 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
@@ -351,16 +497,27 @@ uvmclear(pagetable_t pagetable, uint64 va)
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
+// Faults in pages of the current process that aren't mapped
+// yet, or are shared mappings not yet stored to, and refuses
+// to write read-only pages, which may be shared with other
+// processes.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
+      return -1;
+    pte = walk(pagetable, va0, 0);
+    if((pte == 0 || (*pte & (PTE_V|PTE_W)) != (PTE_V|PTE_W)) &&
+       vmfault(pagetable, va0, PTE_W) == 0)
+      pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
       return -1;
+    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -376,14 +533,23 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 // Copy from user to kernel.
 // Copy len bytes to dst from virtual address srcva in a given page table.
 // Return 0 on success, -1 on error.
+// Memory in [0, p->mm->sz) is copied through the process's kernel
+// page table (see vmcopyin.c); anything else, such as the
+// syscall ring or mmap()ed files, by walking pagetable in
+// software.
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(copyin_new(pagetable, dst, srcva, len) == 0)
+    return 0;
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
+    if(pa0 == 0 && vmfault(pagetable, va0, PTE_R) == 0)
+      pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -402,15 +568,21 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
 // Return 0 on success, -1 on error.
+// Like copyin(), tries the process's kernel page table first.
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(copyinstr_new(pagetable, dst, srcva, max) == 0)
+    return 0;
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
+    if(pa0 == 0 && vmfault(pagetable, va0, PTE_R) == 0)
+      pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
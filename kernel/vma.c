@@ -0,0 +1,513 @@
+//
+// Demand-paged memory: exec'd programs and mmap()ed files.
+//
+// exec() describes each loadable segment of the program with
+// a struct vma in p->mm->vma[], rather than reading the whole
+// file into memory, and mmap() adds a vma for each mapped file.
+// A page is filled in the first time it is touched: user page
+// faults come here from usertrap(), and copyin(), copyinstr()
+// and copyout() call vmfault() themselves.
+//
+// Read-only pages (program text, read-only mappings) and
+// shared mappings map the page cache's page itself (see
+// pcache.c), so processes running the same program share its
+// text, and shared mappings of a file see each other's stores
+// and write()s. Other writable pages are private copies, and
+// bss pages start out as zeros.
+//
+// mmap()ed regions are placed below PLIC, each below the
+// last, and above mm->sz, which can't grow into them. They
+// are not mirrored in the process's kernel page table, so
+// the kernel reaches them by walking the user page table.
+//
+// Threads share an address space (see clone()), and fault
+// pages into it at the same time, so mappings change under
+// mm->lock. Nothing makes other CPUs flush their TLBs, so
+// memory is never unmapped while other threads are live;
+// but a CPU may still hold a stale invalid entry for a page
+// that another just mapped, and fault on it.
+//
+
+#include "types.h"
+#include "param.h"
+#include "stat.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// Does the page at va of v hold data from v->ip?
+static int
+filepage(struct vma *v, uint64 va)
+{
+  return v->ip != 0 && va - v->start < v->filesz;
+}
+
+static struct vma*
+findvma(struct mm *mm, uint64 va)
+{
+  struct vma *v;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Return a page to map at va in v, with a reference for the
+// caller, or 0 if out of memory. Pages of shared mappings,
+// and read-only pages that lie wholly within the file part
+// of v, come straight from the page cache; any other page
+// is private.
+// Caller must hold v->ip->lock if filepage(v, va).
+static uint64
+vmafill(struct vma *v, uint64 va)
+{
+  uint64 segoff = va - v->start;
+  uint64 pa, n;
+  char *mem;
+
+  if(v->flags & VMA_SHARED)
+    return pcacheget(v->ip, v->off + segoff);
+
+  if(filepage(v, va)){
+    n = v->filesz - segoff;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    if(v->off % PGSIZE != 0){
+      // not page-aligned in the file (e.g. a program
+      // linked with ld -N), so not in the page cache.
+      if((mem = kalloc()) == 0)
+        return 0;
+      memset(mem, 0, PGSIZE);
+      if(readi(v->ip, 0, (uint64)mem, v->off + segoff, n) != n){
+        kfree(mem);
+        return 0;
+      }
+      return (uint64)mem;
+    }
+    if((pa = pcacheget(v->ip, v->off + segoff)) == 0)
+      return 0;
+    if(n == PGSIZE && (v->perm & PTE_W) == 0)
+      return pa;
+    // a private copy, with zeros past the file data.
+    if((mem = kalloc()) == 0){
+      kfree((void*)pa);
+      return 0;
+    }
+    memmove(mem, (void*)pa, n);
+    memset(mem + n, 0, PGSIZE - n);
+    kfree((void*)pa);
+    return (uint64)mem;
+  }
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  return (uint64)mem;
+}
+
+// Map the pages of program segment v, in a new page table
+// for exec, that are cheap to map now: writable pages
+// holding file data, so that copyout() into them never has
+// to read the file (it may be called with a spinlock held),
+// and read-only pages that are in the page cache already,
+// so that running a program again takes no page faults for
+// them. The rest are faulted in on demand.
+// Caller must hold v->ip->lock.
+// Returns 0 on success, -1 if out of memory.
+int
+vmaload(pagetable_t pagetable, struct vma *v)
+{
+  uint64 va, pa, segoff;
+
+  for(va = v->start; va < v->end && filepage(v, va); va += PGSIZE){
+    segoff = va - v->start;
+    if(v->perm & PTE_W){
+      if((pa = vmafill(v, va)) == 0)
+        return -1;
+    } else if(v->off % PGSIZE != 0 || segoff + PGSIZE > v->filesz ||
+              (pa = pcachelookup(v->ip, v->off + segoff)) == 0){
+      continue;
+    }
+    if(mappages(pagetable, va, PGSIZE, pa, v->perm | PTE_U) != 0){
+      kfree((void*)pa);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Flush this CPU's TLB entry for va in pagetable, the
+// current process's, after another thread mapped the page
+// or made it writable.
+static void
+vmstale(pagetable_t pagetable, uint64 va)
+{
+  int asid = asidbegin(pagetable);
+
+  if(asid >= 0)
+    sfence_vma_page(va, asid);
+  asidend(asid);
+}
+
+// Fault in the page holding va in the current process,
+// if pagetable is its page table and va falls in one of its
+// vmas that allows access perm (PTE_R, PTE_W or PTE_X).
+// Mirrors new pages below mm->sz in the process's kernel
+// page table.
+// Returns 0 if the access can now go ahead, or -1.
+int
+vmfault(pagetable_t pagetable, uint64 va, int perm)
+{
+  struct proc *p = myproc();
+  struct mm *mm;
+  struct vma *v, vv;
+  pte_t *pte;
+  uint64 pa;
+  int file, locked, asid, flags;
+
+  if(p == 0 || pagetable != p->pagetable)
+    return -1;
+  mm = p->mm;
+  va = PGROUNDDOWN(va);
+
+  acquire(&mm->lock);
+  if((v = findvma(mm, va)) == 0 || (perm & ~v->perm) != 0 ||
+     ((v->flags & VMA_MMAP) == 0 && va >= mm->sz)){
+    // not mapped, or a program segment since cut short
+    // by sbrk().
+    release(&mm->lock);
+    return -1;
+  }
+  vv = *v;
+
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V) != 0){
+    if(*pte & perm){
+      // another thread got here first.
+      release(&mm->lock);
+      vmstale(pagetable, va);
+      return 0;
+    }
+    // pages of shared mappings are mapped read-only until
+    // the first store, so that writable ones are the ones
+    // that may need writing back (see vmaunmap()).
+    if(perm == PTE_W && (vv.flags & VMA_SHARED)){
+      asid = asidbegin(pagetable);
+      *pte |= PTE_W;
+      if(asid >= 0)
+        sfence_vma_page(va, asid);
+      asidend(asid);
+      release(&mm->lock);
+      return 0;
+    }
+    release(&mm->lock);
+    return -1;  // a protection fault
+  }
+  release(&mm->lock);
+
+  // a vma only goes away while no other thread is live,
+  // so vv stays good while the page is filled.
+  file = filepage(&vv, va);
+  if(file){
+    // reading the file sleeps, which isn't allowed with a
+    // spinlock held, and locks vv.ip, which could deadlock
+    // with another sleep-lock held (another inode's, or a
+    // buffer's). read() and write() fault their buffers in
+    // before taking any (see vmprefault()).
+    push_off();
+    locked = mycpu()->noff > 1 || p->nsleeplock > 0;
+    pop_off();
+    if(locked)
+      return -1;
+    ilock(vv.ip);
+  }
+  pa = vmafill(&vv, va);
+  if(file)
+    iunlock(vv.ip);
+  if(pa == 0)
+    return -1;
+
+  flags = vv.perm | PTE_U;
+  if((vv.flags & VMA_SHARED) && perm != PTE_W)
+    flags &= ~PTE_W;
+  acquire(&mm->lock);
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V) != 0){
+    // another thread faulted the page in meanwhile.
+    release(&mm->lock);
+    kfree((void*)pa);
+    return vmfault(pagetable, va, perm);
+  }
+  if(mappages(pagetable, va, PGSIZE, pa, flags) != 0){
+    release(&mm->lock);
+    kfree((void*)pa);
+    return -1;
+  }
+  if(va < mm->sz && kvmmapuser(pagetable, mm->kpagetable, va, va + PGSIZE) < 0){
+    uvmunmap(pagetable, va, 1, 1);
+    release(&mm->lock);
+    return -1;
+  }
+  release(&mm->lock);
+  return 0;
+}
+
+// Fault in the pages of [va, va+len) of the current process
+// that can't be accessed with perm yet, for a caller about to
+// copy to or from them with a lock held, when vmfault() can't
+// read files. Stops at the first page that can't be faulted
+// in, leaving the copy to fail there.
+void
+vmprefault(uint64 va, uint64 len, int perm)
+{
+  pagetable_t pagetable = myproc()->pagetable;
+  uint64 a;
+  pte_t *pte;
+
+  if(va + len < va || va + len > MAXVA)
+    return;
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    // no mm->lock: a page-table page never goes away while
+    // another thread might be mapping pages, and vmfault()
+    // looks again.
+    if((pte = walk(pagetable, a, 0)) != 0 &&
+       (*pte & (PTE_V|perm)) == (PTE_V|perm))
+      continue;
+    if(vmfault(pagetable, a, perm) < 0)
+      return;
+  }
+}
+
+// Lowest address of mm's mmap()ed regions; mm->sz must
+// stay below it. Caller must hold mm->lock.
+uint64
+mmapbase(struct mm *mm)
+{
+  struct vma *v;
+  uint64 base = PLIC;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if((v->flags & VMA_MMAP) && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// Map len bytes of f, starting at offset off, at an address
+// below the current process's other mappings. prot and flags
+// are as for mmap(2): PROT_* and one of MAP_SHARED and
+// MAP_PRIVATE. Bytes past the end of the file read as zero.
+// Returns the address, or -1.
+uint64
+mmap(struct file *f, uint64 len, int prot, int flags, uint off)
+{
+  struct mm *mm = myproc()->mm;
+  struct vma *v;
+  uint64 start;
+  int perm;
+
+  if(len == 0 || len > PLIC || off % PGSIZE != 0 || off + len >= (1L << 32))
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if((prot & PROT_WRITE) && flags == MAP_SHARED && !f->writable)
+    return -1;
+
+  ilock(f->ip);
+  if(f->ip->type != T_FILE){
+    iunlock(f->ip);
+    return -1;
+  }
+  iunlock(f->ip);
+
+  // the hardware has no write-only pages.
+  perm = 0;
+  if(prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  len = PGROUNDUP(len);
+  acquire(&mm->lock);
+  if(len > mmapbase(mm) || (start = mmapbase(mm) - len) < PGROUNDUP(mm->sz)){
+    release(&mm->lock);
+    return -1;
+  }
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++)
+    if(v->start == v->end)
+      break;
+  if(v == &mm->vma[NVMA]){
+    release(&mm->lock);
+    return -1;
+  }
+  v->start = start;
+  v->end = start + len;
+  v->perm = perm;
+  v->flags = VMA_MMAP | (flags == MAP_SHARED ? VMA_SHARED : 0);
+  v->ip = idup(f->ip);
+  v->off = off;
+  v->filesz = len;
+  release(&mm->lock);
+  return start;
+}
+
+// Write back the pages in [start, end) of v that a shared
+// mapping may have stored to, and unmap the range.
+static void
+vmaunmap(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 va;
+  pte_t *pte;
+  uint off, n;
+
+  if(v->flags & VMA_SHARED){
+    for(va = start; va < end; va += PGSIZE){
+      pte = walk(pagetable, va, 0);
+      if(pte == 0 || (*pte & (PTE_V|PTE_W)) != (PTE_V|PTE_W))
+        continue;
+      // one page is four blocks and the inode, well
+      // within a transaction, as long as the file
+      // doesn't grow.
+      off = v->off + (va - v->start);
+      begin_op();
+      ilock(v->ip);
+      n = 0;
+      if(off < v->ip->size){
+        n = v->ip->size - off;
+        if(n > PGSIZE)
+          n = PGSIZE;
+        writei(v->ip, 0, PTE2PA(*pte), off, n);
+      }
+      // the page is the cached one, which readi() prefers:
+      // drop stores past the end of the file, so that they
+      // can't turn up in it later.
+      if(n < PGSIZE)
+        memset((char*)PTE2PA(*pte) + n, 0, PGSIZE - n);
+      iunlock(v->ip);
+      end_op();
+    }
+  }
+  uvmunmap(pagetable, start, (end - start) / PGSIZE, 1);
+}
+
+// Unmap [addr, addr+len) of the current process's mmap()ed
+// regions, writing shared pages back to their files.
+// Cutting a hole in the middle of a region needs a free
+// vma for the upper part. Not allowed while other threads
+// are live: they may have the pages in their TLBs.
+// Returns 0, or -1.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+  struct vma *v, *nv;
+  uint64 end, a, b;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr || addr + len > PLIC)
+    return -1;
+  if(mm->nlive > 1)
+    return -1;
+  end = PGROUNDUP(addr + len);
+
+  // find a free vma first, in case a region has to be split.
+  for(nv = mm->vma; nv < &mm->vma[NVMA]; nv++)
+    if(nv->start == nv->end)
+      break;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if((v->flags & VMA_MMAP) == 0 || v->end <= addr || v->start >= end)
+      continue;
+    a = addr > v->start ? addr : v->start;
+    b = end < v->end ? end : v->end;
+    if(a > v->start && b < v->end){
+      if(nv == &mm->vma[NVMA])
+        return -1;
+      *nv = *v;
+      idup(nv->ip);
+      nv->off += b - v->start;
+      nv->start = b;
+      nv->filesz = nv->end - nv->start;
+    }
+    vmaunmap(p->pagetable, v, a, b);
+    if(a > v->start){
+      v->end = a;
+    } else if(b < v->end){
+      v->off += b - v->start;
+      v->start = b;
+    } else {
+      begin_op();
+      iput(v->ip);
+      end_op();
+      memset(v, 0, sizeof(*v));
+      continue;
+    }
+    v->filesz = v->end - v->start;
+  }
+  return 0;
+}
+
+// Write back and unmap all of mm's mmap()ed regions, for
+// mmexit(), once no thread is live. Leaves the vmas to
+// vmafree().
+void
+vmaunmapall(struct mm *mm)
+{
+  for(int i = 0; i < NVMA; i++)
+    if(mm->vma[i].flags & VMA_MMAP)
+      vmaunmap(mm->pagetable, &mm->vma[i], mm->vma[i].start, mm->vma[i].end);
+}
+
+// Give nmm, a child's address space, mm's vmas, for fork():
+// copies of private mmap()ed pages, and the same pages of
+// shared ones. Caller must hold mm->lock.
+// Returns 0, or -1 if out of memory.
+int
+vmacopy(struct mm *nmm, struct mm *mm)
+{
+  struct vma *v, *u;
+
+  for(v = mm->vma; v < &mm->vma[NVMA]; v++){
+    if((v->flags & VMA_MMAP) == 0)
+      continue;
+    if(uvmcopy(mm->pagetable, nmm->pagetable, v->start, v->end, v->flags & VMA_SHARED) < 0){
+      for(u = mm->vma; u < v; u++)
+        if(u->flags & VMA_MMAP)
+          uvmunmap(nmm->pagetable, u->start, (u->end - u->start) / PGSIZE, 1);
+      return -1;
+    }
+  }
+
+  for(int i = 0; i < NVMA; i++){
+    nmm->vma[i] = mm->vma[i];
+    if(nmm->vma[i].ip == 0)
+      continue;
+    idup(nmm->vma[i].ip);
+    if((nmm->vma[i].flags & VMA_MMAP) == 0)
+      __sync_fetch_and_add(&nmm->vma[i].ip->ntext, 1);
+  }
+  return 0;
+}
+
+// Release the inodes of an array of NVMA vmas, and clear it.
+// Must be called inside a transaction, since it calls iput().
+void
+vmafree(struct vma *vma)
+{
+  for(int i = 0; i < NVMA; i++){
+    if(vma[i].ip == 0)
+      continue;
+    if((vma[i].flags & VMA_MMAP) == 0)
+      __sync_fetch_and_sub(&vma[i].ip->ntext, 1);
+    iput(vma[i].ip);
+  }
+  memset(vma, 0, NVMA * sizeof(struct vma));
+}
@@ -0,0 +1,65 @@
+#include "param.h"
+#include "types.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+//
+// Copying from user space through the process's kernel page
+// table (p->kpagetable), which maps user memory [0, p->mm->sz) at
+// the same virtual addresses, without PTE_U. The MMU does the
+// translation, so there is no software walk of the user page
+// table as in copyin() and copyinstr() in vm.c. Pages that
+// aren't mirrored, because they haven't been faulted in yet or
+// the user can't touch them (the stack guard page), make the
+// copy fail (see ucopy.S), and copyin() and copyinstr() then
+// walk the page table instead.
+//
+
+// Copy from user to kernel.
+// Copy len bytes to dst from virtual address srcva in the
+// current process's address space, if pagetable is its.
+// Return 0 on success, -1 on error.
+int
+copyin_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
+{
+  struct proc *p = myproc();
+  int r;
+
+  if(p == 0 || pagetable != p->pagetable)
+    return -1;
+  if(srcva >= p->mm->sz || srcva+len > p->mm->sz || srcva+len < srcva)
+    return -1;
+  // no yield, so that the fault comes on this CPU.
+  push_off();
+  mycpu()->ucopy = 1;
+  r = ucopy(dst, (char *)srcva, len);
+  mycpu()->ucopy = 0;
+  pop_off();
+  return r;
+}
+
+// Copy a null-terminated string from user to kernel.
+// Copy bytes to dst from virtual address srcva in the
+// current process's address space, if pagetable is its,
+// until a '\0', or max.
+// Return 0 on success, -1 on error.
+int
+copyinstr_new(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
+{
+  struct proc *p = myproc();
+  int r;
+
+  if(p == 0 || pagetable != p->pagetable || srcva >= p->mm->sz)
+    return -1;
+  if(max > p->mm->sz - srcva)
+    max = p->mm->sz - srcva;
+  push_off();
+  mycpu()->ucopy = 1;
+  r = ucopystr(dst, (char *)srcva, max);
+  mycpu()->ucopy = 0;
+  pop_off();
+  return r;
+}
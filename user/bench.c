@@ -0,0 +1,238 @@
+// bench [-s scale] [name ...]
+//
+// Time some basic kernel operations, all of them or just
+// the ones named, and print one line for each:
+//   bench name ops ns/op cycles/op
+// ops is the number of operations timed; the times come
+// from the time CSR (TIMEFREQ Hz) and the cycle CSR, both
+// of which user code can read. -s multiplies the number of
+// operations. gradelib.py parses these lines.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define BLK   4096
+#define FILESZ (256*1024)  // below MAXFILE
+
+char buf[BLK];
+char *self = "/bench";
+
+void
+fail(char *what)
+{
+  fprintf(2, "bench: %s failed\n", what);
+  exit(1);
+}
+
+// fork a child that execs this program, which exits at once.
+void
+forkexec(int n)
+{
+  char *argv[] = { self, "-x", 0 };
+  int i, pid;
+
+  for(i = 0; i < n; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      exec(self, argv);
+      fail("exec");
+    }
+    wait(0);
+  }
+}
+
+// the same with spawn().
+void
+spawnexec(int n)
+{
+  char *argv[] = { self, "-x", 0 };
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(spawn(self, argv) < 0)
+      fail("spawn");
+    wait(0);
+  }
+}
+
+// send a byte to a child and back.
+void
+pipert(int n)
+{
+  int to[2], from[2], i, pid;
+  char c = 0;
+
+  if(pipe(to) < 0 || pipe(from) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(to[1]);
+    close(from[0]);
+    while(read(to[0], &c, 1) == 1)
+      write(from[1], &c, 1);
+    exit(0);
+  }
+  close(to[0]);
+  close(from[1]);
+  for(i = 0; i < n; i++){
+    if(write(to[1], &c, 1) != 1 || read(from[0], &c, 1) != 1)
+      fail("pipe round trip");
+  }
+  close(to[1]);
+  close(from[0]);
+  wait(0);
+}
+
+// create, write 100 bytes to, and delete a file.
+void
+smallfile(int n)
+{
+  int i, fd;
+
+  for(i = 0; i < n; i++){
+    if((fd = open("bench.tmp", O_CREATE|O_WRONLY)) < 0)
+      fail("create");
+    if(write(fd, buf, 100) != 100)
+      fail("write");
+    close(fd);
+    if(unlink("bench.tmp") < 0)
+      fail("unlink");
+  }
+}
+
+// write a file, BLK bytes per op; seqread reads back the
+// one seqwrite left.
+void
+seqrw(int n, int rd)
+{
+  int i, j, fd;
+
+  for(i = 0; i < n; i += FILESZ/BLK){
+    if(!rd){
+      if((fd = open("bench.big", O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+        fail("create");
+    } else if((fd = open("bench.big", O_RDONLY)) < 0){
+      fail("open");
+    }
+    for(j = 0; j < FILESZ/BLK; j++){
+      if((rd ? read(fd, buf, BLK) : write(fd, buf, BLK)) != BLK)
+        fail(rd ? "read" : "write");
+    }
+    close(fd);
+  }
+}
+
+void seqwrite(int n) { seqrw(n, 0); }
+void seqread(int n) { seqrw(n, 1); }
+
+// grow the heap by a page, touch it, and shrink it back.
+void
+sbrkpage(int n)
+{
+  int i;
+  char *p;
+
+  for(i = 0; i < n; i++){
+    if((p = sbrk(BLK)) == (char*)-1)
+      fail("sbrk");
+    *p = 1;
+    sbrk(-BLK);
+  }
+}
+
+// pass the turn to another thread and back, through a futex.
+volatile int turn;
+int nswitch;
+
+void
+pong(void *arg)
+{
+  int i;
+
+  for(i = 0; i < nswitch; i++){
+    while(turn != 1)
+      futex_wait((int*)&turn, 0);
+    turn = 0;
+    futex_wake((int*)&turn, 1);
+  }
+}
+
+void
+ctxswitch(int n)
+{
+  int i, tid;
+
+  turn = 0;
+  nswitch = n;
+  if((tid = thread_create(pong, 0)) < 0)
+    fail("thread_create");
+  for(i = 0; i < n; i++){
+    turn = 1;
+    futex_wake((int*)&turn, 1);
+    while(turn != 0)
+      futex_wait((int*)&turn, 1);
+  }
+  thread_join(tid);
+}
+
+struct bench {
+  char *name;
+  void (*fn)(int);
+  int ops;
+} benches[] = {
+  { "forkexec", forkexec, 50 },
+  { "spawnexec", spawnexec, 50 },
+  { "pipert", pipert, 2000 },
+  { "smallfile", smallfile, 200 },
+  { "seqwrite", seqwrite, 256 },
+  { "seqread", seqread, 256 },
+  { "sbrk", sbrkpage, 2000 },
+  { "switch", ctxswitch, 2000 },
+};
+
+void
+run(struct bench *b, int scale)
+{
+  uint64 t0, c0, dt, dc;
+  int ops = b->ops * scale;
+
+  t0 = rdtime();
+  c0 = rdcycle();
+  b->fn(ops);
+  dc = rdcycle() - c0;
+  dt = rdtime() - t0;
+  printf("bench %s %d %l %l\n", b->name, ops,
+         dt * (1000000000 / TIMEFREQ) / ops, dc / ops);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, scale = 1, any;
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+  if(argc > 2 && strcmp(argv[1], "-s") == 0){
+    if((scale = atoi(argv[2])) < 1)
+      scale = 1;
+    argc -= 2;
+    argv += 2;
+  }
+
+  printf("# name ops ns/op cycles/op\n");
+  for(i = 0; i < sizeof(benches)/sizeof(benches[0]); i++){
+    any = argc < 2;
+    for(j = 1; j < argc; j++)
+      if(strcmp(argv[j], benches[i].name) == 0)
+        any = 1;
+    if(any)
+      run(&benches[i], scale);
+  }
+  unlink("bench.big");
+  exit(0);
+}
@@ -2,12 +2,26 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[512];
+// files are copied with sendfile(), in the kernel; other
+// input (pipes, the console) through a big buffer.
+
+#define BUFSZ (32*1024)
+
+char buf[BUFSZ];
 
 void
 cat(int fd)
 {
-  int n;
+  int n, sent;
+
+  for(sent = 0; (n = sendfile(1, fd, BUFSZ)) > 0; sent += n)
+    ;
+  if(n == 0)
+    return;
+  if(sent > 0){
+    fprintf(2, "cat: write error\n");
+    exit(1);
+  }
 
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
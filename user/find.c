@@ -2,73 +2,201 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fs.h"
-void find(char *path, char *target)
+
+// find [-j n] path target
+//
+// Directories are read NENT entries per getdents() call, which
+// also gives each entry's type, so nothing is opened but the
+// directories themselves. Subdirectories are searched by up to
+// n forked workers at once (default NWORKER): each subdirectory
+// of path gets one, waiting for a free one if need be, and a
+// worker hands the subdirectories it meets to workers of its
+// own while it has some of the n to spare, so that one deep
+// subdirectory doesn't leave the rest idle. Output is collected
+// into whole lines, so that the workers' lines don't mix.
+
+#define NENT 64
+#define NWORKER 4
+
+int nworker = NWORKER;  // workers this process may have at once
+int running;            // of those, how many are taken
+int *kid, *kidslots;    // our workers, and how many each took
+int nkid;
+
+char out[512];
+int nout;
+
+void flush(void)
 {
-    char buf[512], *p;
-    int fd;
-    struct dirent de;
-    struct stat st;
+    if (nout > 0)
+        write(1, out, nout);
+    nout = 0;
+}
 
-    if ((fd = open(path, 0)) < 0)
+void emit(char *path)
+{
+    int n = strlen(path);
+
+    if (nout + n + 1 > sizeof out)
+        flush();
+    if (n + 1 > sizeof out)
     {
-        fprintf(2, "find: cannot open %s\n", path);
+        write(1, path, n);
+        write(1, "\n", 1);
         return;
     }
+    memmove(out + nout, path, n);
+    nout += n;
+    out[nout++] = '\n';
+}
+
+void find(char *path, char *target, int top);
 
-    if (fstat(fd, &st) < 0)
+// wait for one of our workers to finish, and take back
+// its share.
+void reap(void)
+{
+    int pid, i;
+
+    if ((pid = wait(0)) < 0)
     {
-        fprintf(2, "find: cannot stat %s\n", path);
-        close(fd);
+        nkid = running = 0;
+        return;
+    }
+    for (i = 0; i < nkid; i++)
+    {
+        if (kid[i] == pid)
+        {
+            running -= kidslots[i];
+            nkid--;
+            kid[i] = kid[nkid];
+            kidslots[i] = kidslots[nkid];
+            return;
+        }
+    }
+}
+
+// search dir with a new worker, which gets half of the workers
+// we have spare for its own. At the top level, wait for one to
+// finish if all are busy; further down, search dir here instead.
+void worker(char *dir, char *target, int top)
+{
+    int pid, share;
+
+    if (top)
+        while (running == nworker)
+            reap();
+    if (running == nworker)
+    {
+        find(dir, target, 0);
+        return;
+    }
+    share = (nworker - running - 1) / 2;
+    flush();
+    if ((pid = fork()) < 0)
+    {
+        find(dir, target, 0);
+        return;
+    }
+    if (pid == 0)
+    {
+        nworker = share;
+        running = nkid = 0;
+        find(dir, target, 0);
+        flush();
+        while (nkid > 0)
+            reap();
+        exit(0);
+    }
+    kid[nkid] = pid;
+    kidslots[nkid++] = 1 + share;
+    running += 1 + share;
+}
+
+void find(char *path, char *target, int top)
+{
+    char buf[512], *p;
+    int fd, n, i;
+    struct direntry *de;
+
+    if ((fd = open(path, 0)) < 0)
+    {
+        fprintf(2, "find: cannot open %s\n", path);
         return;
     }
 
     if (strlen(path) + 1 + DIRSIZ + 1 > sizeof buf)
     {
         fprintf(2, "find: path too long\n");
+        close(fd);
         return;
     }
 
     strcpy(buf, path);
     p = buf + strlen(buf);
-    if (*p != '/')
+    if (p[-1] != '/')
         *p++ = '/';
 
-    while (read(fd, &de, sizeof(de)) == sizeof(de))
+    // on the heap: the stack is one page, and this recurses.
+    if ((de = malloc(NENT * sizeof(*de))) == 0)
     {
-        if (de.inum == 0 || !strcmp(".", de.name) || !strcmp("..", de.name))
-            continue;
-            
-        memmove(p, de.name, DIRSIZ);
-        p[DIRSIZ] = 0;
+        fprintf(2, "find: out of memory\n");
+        close(fd);
+        return;
+    }
 
-        if (stat(buf, &st) < 0)
+    while ((n = getdents(fd, de, NENT)) > 0)
+    {
+        for (i = 0; i < n; i++)
         {
-            printf("find: cannot stat %s\n", buf);
-            continue;
-        }
+            if (!strcmp(".", de[i].name) || !strcmp("..", de[i].name))
+                continue;
 
-        switch (st.type)
-        {
-        case T_FILE:
-            if (strcmp(target, de.name) == 0)
-                printf("%s\n", buf);
-            break;
-        case T_DIR:
-            find(buf, target);
+            strcpy(p, de[i].name);
+
+            switch (de[i].type)
+            {
+            case T_FILE:
+                if (strcmp(target, de[i].name) == 0)
+                    emit(buf);
+                break;
+            case T_DIR:
+                if (nworker > 0)
+                    worker(buf, target, top);
+                else
+                    find(buf, target, 0);
+            }
         }
     }
+    if (n < 0)
+        fprintf(2, "find: %s is not a directory\n", path);
+    free(de);
     close(fd);
     return;
 }
 
 int main(int ac, char *av[])
 {
+    if (ac > 2 && strcmp(av[1], "-j") == 0)
+    {
+        nworker = atoi(av[2]);
+        ac -= 2;
+        av += 2;
+    }
     if (ac < 3)
     {
-        printf("Usage: find path target\n");
+        printf("Usage: find [-j n] path target\n");
         exit(0);
     }
-    find(".", av[2]);
+    if (nworker < 2)
+        nworker = 0;  // search it all here
+    if (nworker > 0 && ((kid = malloc(nworker * sizeof(int))) == 0 ||
+                        (kidslots = malloc(nworker * sizeof(int))) == 0))
+        nworker = 0;
+    find(av[1], av[2], 1);
+    flush();
+    while (nkid > 0)
+        reap();
 
     exit(0);
-}
\ No newline at end of file
+}
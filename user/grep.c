@@ -1,35 +1,232 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// The pattern is compiled once into a bit-parallel NFA
+// (shift-and, with * as a self-loop), which runs in time
+// linear in the text, however many *s the pattern has. Lines
+// that can't match are skipped without running it: a
+// Boyer-Moore-Horspool search for the pattern's longest
+// literal string finds the only lines worth looking at.
+//
+// Input is read BUFSZ bytes at a time into a buffer that
+// grows to hold the longest line, and each run of adjacent
+// matching lines goes out in one write().
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[1024];
+#define BUFSZ (64*1024)
+
+char *buf;
+int bufsz;
 int match(char*, char*);
 
+// the compiled pattern. state bit i means the first i atoms
+// (a character or '.', maybe starred) have matched.
+#define MAXATOM 63
+
+int natom;
+uint64 accept[256];   // atoms each character matches
+uint64 star;          // starred atoms
+uint64 final;         // bit natom
+int bol, eol;         // pattern starts with ^, ends with $
+int compiled;         // 0 if too long: use match()
+
+char *lit;            // longest run of plain characters
+int nlit;
+int skip[256];        // Horspool shifts for lit
+
+void
+compile(char *re)
+{
+  int i, c, n, start;
+
+  if(re[0] == '^'){
+    bol = 1;
+    re++;
+  }
+  start = 0;
+  for(i = 0; re[i]; ){
+    if(natom == MAXATOM){
+      nlit = 0;
+      return;
+    }
+    if(re[i+1] == '*'){
+      star |= 1L << natom;
+      n = 2;
+    } else if(re[i] == '$' && re[i+1] == '\0'){
+      eol = 1;
+      break;
+    } else {
+      n = 1;
+    }
+    for(c = 0; c < 256; c++)
+      if(re[i] == '.' || re[i] == (char)c)
+        accept[c] |= 1L << natom;
+
+    // track runs of atoms that are plain characters.
+    if(n == 2 || re[i] == '.'){
+      start = i + n;
+    } else if(i + 1 - start > nlit){
+      lit = re + start;
+      nlit = i + 1 - start;
+    }
+    natom++;
+    i += n;
+  }
+  final = 1L << natom;
+  compiled = 1;
+
+  for(c = 0; c < 256; c++)
+    skip[c] = nlit;
+  for(i = 0; i < nlit - 1; i++)
+    skip[(uchar)lit[i]] = nlit - 1 - i;
+}
+
+// add the states reachable by skipping starred atoms.
+uint64
+closure(uint64 d)
+{
+  uint64 n;
+
+  while((n = d | ((d & star) << 1)) != d)
+    d = n;
+  return d;
+}
+
+// does the line s[0..n) match?
+int
+matchline(char *s, int n)
+{
+  uint64 d, t, init;
+  int i;
+
+  init = closure(1);
+  d = init;
+  for(i = 0; i < n; i++){
+    if(!eol && (d & final))
+      return 1;
+    t = d & accept[(uchar)s[i]];
+    d = ((t & ~star) << 1) | (t & star);
+    if(star)
+      d = closure(d);
+    if(!bol)
+      d |= init;
+    else if(d == 0)
+      return 0;
+  }
+  return (d & final) != 0;
+}
+
+// first occurrence of lit in [p, end), or 0.
+char*
+findlit(char *p, char *end)
+{
+  char *e, last = lit[nlit-1];
+
+  for(e = p + nlit - 1; e < end; e += skip[(uchar)*e]){
+    if(*e == last && memcmp(e - nlit + 1, lit, nlit) == 0)
+      return e - nlit + 1;
+  }
+  return 0;
+}
+
+// first newline in [p, end), which must hold one. looks at
+// a word at a time: a byte of x is zero where the word has
+// a newline, and (x - 0x01..) & ~x & 0x80.. finds the first.
+char*
+findnl(char *p)
+{
+  uint64 x;
+
+  for(; (uint64)p % sizeof(uint64) != 0; p++)
+    if(*p == '\n')
+      return p;
+  for(;; p += sizeof(uint64)){
+    x = *(uint64*)p ^ 0x0a0a0a0a0a0a0a0aL;
+    if((x - 0x0101010101010101L) & ~x & 0x8080808080808080L)
+      break;
+  }
+  while(*p != '\n')
+    p++;
+  return p;
+}
+
+// write out the lines of [p, end) that match; each ends
+// with a newline.
+void
+grepbuf(char *pattern, char *p, char *end)
+{
+  char *q, *run;
+  int ok;
+
+  run = p;  // matching lines in [run, p) not written yet
+  while(p < end){
+    if(nlit > 0){
+      if((q = findlit(p, end)) == 0)
+        break;
+      // back up to the start of q's line.
+      while(q > p && q[-1] != '\n')
+        q--;
+      if(q != p){
+        if(run < p)
+          write(1, run, p - run);
+        run = p = q;
+      }
+    }
+    q = findnl(p);
+    if(compiled){
+      ok = matchline(p, q - p);
+    } else {
+      *q = 0;
+      ok = match(pattern, p);
+      *q = '\n';
+    }
+    if(!ok){
+      if(run < p)
+        write(1, run, p - run);
+      run = q+1;
+    }
+    p = q+1;
+  }
+  if(run < p)
+    write(1, run, p - run);
+}
+
 void
 grep(char *pattern, int fd)
 {
   int n, m;
-  char *p, *q;
+  char *p, *nbuf;
 
   m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
-    m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
+  for(;;){
+    if(bufsz - m < BUFSZ/2){
+      // room for a big read after a long partial line, and
+      // for a newline after the last line if it hasn't one.
+      n = bufsz*2 > m + BUFSZ ? bufsz*2 : m + BUFSZ;
+      if((nbuf = malloc(n + 1)) == 0){
+        fprintf(2, "grep: out of memory\n");
+        exit(1);
       }
-      p = q+1;
-    }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+      memmove(nbuf, buf, m);
+      free(buf);
+      buf = nbuf;
+      bufsz = n;
     }
+    if((n = read(fd, buf+m, bufsz-m)) <= 0)
+      break;
+    m += n;
+    // the complete lines read so far.
+    for(p = buf + m; p > buf && p[-1] != '\n'; p--)
+      ;
+    grepbuf(pattern, buf, p);
+    m -= p - buf;
+    memmove(buf, p, m);
+  }
+  if(m > 0){
+    buf[m++] = '\n';
+    grepbuf(pattern, buf, buf + m);
   }
 }
 
@@ -44,6 +241,7 @@ main(int argc, char *argv[])
     exit(1);
   }
   pattern = argv[1];
+  compile(pattern);
 
   if(argc <= 2){
     grep(pattern, 0);
@@ -63,6 +261,7 @@ main(int argc, char *argv[])
 
 // Regexp matcher from Kernighan & Pike,
 // The Practice of Programming, Chapter 9.
+// Used for patterns too long to compile.
 
 int matchhere(char*, char*);
 int matchstar(int, char*, char*);
@@ -102,4 +301,3 @@ int matchstar(int c, char *re, char *text)
   }while(*text!='\0' && (*text++==c || c=='.'));
   return 0;
 }
-
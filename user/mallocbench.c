@@ -0,0 +1,184 @@
+// mallocbench: speed of the ulib malloc() and free(), and of
+// the Kernighan and Ritchie allocator they replaced, which is
+// copied here as krmalloc() and krfree().
+//
+// Each test does OPS malloc()/free() pairs, and prints the
+// nanoseconds per pair for both allocators:
+//   lifo   frees each block right after allocating it
+//   churn  keeps LIVE small blocks of random sizes, freeing
+//          a random one for each new one
+//   big    the same with blocks of 2 to 8 KB
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define OPS   20000
+#define LIVE  512
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+void
+krfree(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  krfree((void*)(hp + 1));
+  return freep;
+}
+
+void*
+krmalloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+struct allocator {
+  char *name;
+  void *(*malloc)(uint);
+  void (*free)(void*);
+} allocators[] = {
+  { "ulib", malloc, free },
+  { "kr", krmalloc, krfree },
+};
+
+enum { LIFO, CHURN, BIG };
+char *testnames[] = { "lifo", "churn", "big" };
+
+void *live[LIVE];
+uint seed;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void*
+get(struct allocator *a, uint n)
+{
+  void *p;
+
+  if((p = a->malloc(n)) == 0){
+    fprintf(2, "mallocbench: out of memory\n");
+    exit(1);
+  }
+  *(char*)p = 1;
+  return p;
+}
+
+uint64
+run(struct allocator *a, int test)
+{
+  uint64 t0, dt;
+  int i, j, min, max;
+
+  min = test == BIG ? 2048 : 8;
+  max = test == BIG ? 8192 : 512;
+  seed = 1;
+  if(test != LIFO)
+    for(i = 0; i < LIVE; i++)
+      live[i] = get(a, min + rand() % (max - min));
+
+  t0 = rdtime();
+  for(i = 0; i < OPS; i++){
+    if(test == LIFO){
+      a->free(get(a, 32));
+    } else {
+      j = rand() % LIVE;
+      a->free(live[j]);
+      live[j] = get(a, min + rand() % (max - min));
+    }
+  }
+  dt = rdtime() - t0;
+
+  if(test != LIFO)
+    for(i = 0; i < LIVE; i++)
+      a->free(live[i]);
+  return dt;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int t, i;
+  uint64 dt;
+
+  printf("test allocator ns/op\n");
+  for(t = LIFO; t <= BIG; t++){
+    for(i = 0; i < sizeof(allocators)/sizeof(allocators[0]); i++){
+      dt = run(&allocators[i], t);
+      printf("%s %s %d\n", testnames[t], allocators[i].name,
+             (int)(dt * (1000000000 / TIMEFREQ) / OPS));
+    }
+  }
+  exit(0);
+}
@@ -0,0 +1,77 @@
+// membench: throughput of the ulib memset, memmove and memcmp.
+//
+// For each operation and size, moves about TOTAL bytes and
+// prints bytes per cycle of the cycle CSR (x100, since there
+// is no floating point printf).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define TOTAL  (8*1024*1024)
+#define MAXSZ  (64*1024)
+
+char *a, *b;
+
+int sizes[] = { 16, 64, 512, 1024, 4096, MAXSZ };
+
+enum { SET, MOVE, MOVEODD, CMP };
+char *opnames[] = { "memset", "memmove", "memmove+1", "memcmp" };
+
+uint64
+run(int op, int n)
+{
+  uint64 t0;
+  int i, iters;
+
+  iters = TOTAL / n;
+  t0 = rdcycle();
+  for(i = 0; i < iters; i++){
+    switch(op){
+    case SET:
+      memset(a, i, n);
+      break;
+    case MOVE:
+      memmove(a, b, n);
+      break;
+    case MOVEODD:
+      memmove(a, b + 1, n);
+      break;
+    case CMP:
+      if(memcmp(a, b, n) != 0){
+        fprintf(2, "membench: memcmp mismatch\n");
+        exit(1);
+      }
+      break;
+    }
+  }
+  return rdcycle() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int op, i, n;
+  uint64 dt, bytes;
+
+  a = malloc(MAXSZ + 64);
+  b = malloc(MAXSZ + 64);
+  if(a == 0 || b == 0){
+    fprintf(2, "membench: out of memory\n");
+    exit(1);
+  }
+  memset(b, 'x', MAXSZ + 64);
+
+  printf("op size bytes/cycle*100\n");
+  for(op = SET; op <= CMP; op++){
+    if(op == CMP)
+      memmove(a, b, MAXSZ);
+    for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+      n = sizes[i];
+      dt = run(op, n);
+      bytes = (uint64)(TOTAL / n) * n;
+      printf("%s %d %d\n", opnames[op], n, (int)(bytes * 100 / (dt ? dt : 1)));
+    }
+  }
+  exit(0);
+}
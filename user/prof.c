@@ -0,0 +1,131 @@
+// prof cmd [args...]
+//
+// run cmd with the sampling profiler on, then print one line
+// per distinct sampled pc, most frequent first:
+//
+//   count k|u name pc
+//
+// prof-symbolize (in the top-level directory) turns the pcs
+// into function names using kernel/kernel.sym and user/name.sym.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+#define NBUCKET 1024
+#define NSAMPLE 64
+
+struct hit {
+  uint64 pc;
+  int user;
+  char name[16];
+  int count;
+};
+
+struct hit hits[NBUCKET];
+int nhits;
+int nlost;
+
+void
+record(struct profsample *s)
+{
+  uint h;
+  struct hit *e;
+
+  h = (uint)(s->pc >> 2) * 2654435761U;
+  for(h %= NBUCKET; ; h = (h + 1) % NBUCKET){
+    e = &hits[h];
+    if(e->count == 0)
+      break;
+    if(e->pc == s->pc && e->user == s->user &&
+       (!s->user || strcmp(e->name, s->name) == 0)){
+      e->count++;
+      return;
+    }
+  }
+  if(nhits == NBUCKET - 1){
+    nlost++;
+    return;
+  }
+  e->pc = s->pc;
+  e->user = s->user;
+  strcpy(e->name, s->user ? s->name : "kernel");
+  e->count = 1;
+  nhits++;
+}
+
+void
+drain(void)
+{
+  struct profsample buf[NSAMPLE];
+  int i, n;
+
+  while((n = profread(buf, NSAMPLE)) > 0)
+    for(i = 0; i < n; i++)
+      record(&buf[i]);
+}
+
+void
+report(void)
+{
+  struct hit *v, t;
+  int i, j, n, total;
+
+  // compact the table, then insertion sort by count.
+  v = hits;
+  n = 0;
+  total = 0;
+  for(i = 0; i < NBUCKET; i++){
+    if(hits[i].count){
+      total += hits[i].count;
+      v[n++] = hits[i];
+    }
+  }
+  for(i = 1; i < n; i++){
+    t = v[i];
+    for(j = i; j > 0 && v[j-1].count < t.count; j--)
+      v[j] = v[j-1];
+    v[j] = t;
+  }
+
+  printf("%d samples\n", total);
+  for(i = 0; i < n; i++)
+    printf("%d %s %s %p\n", v[i].count, v[i].user ? "u" : "k", v[i].name, v[i].pc);
+  if(nlost)
+    printf("prof: %d samples at new pcs not counted\n", nlost);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pid;
+
+  if(argc < 2){
+    fprintf(2, "usage: prof cmd [args...]\n");
+    exit(1);
+  }
+
+  if(profile(1) < 0){
+    fprintf(2, "prof: profile failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+
+  // each CPU buffers NPROFBUF samples (about 100 seconds
+  // at the timer rate), so reading them afterwards is enough.
+  wait(0);
+  profile(0);
+  drain();
+  report();
+  exit(0);
+}
@@ -1,6 +1,7 @@
 // Shell.
 
 #include "kernel/types.h"
+#include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
 
@@ -52,6 +53,89 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+int simple(char*);
+void runcmd(struct cmd*);
+
+// Where commands were last found. A name without a '/' is
+// looked for in the current directory, then in /; cd
+// forgets them all, and a failed exec the one it ran.
+#define NCACHE 16
+#define CMDNAME 16
+
+struct {
+  char name[CMDNAME];
+  char path[CMDNAME+1];
+} cmdcache[NCACHE];
+int nextcache;
+
+char*
+lookup(char *name)
+{
+  int i;
+  struct stat st;
+  char *path;
+
+  if(strchr(name, '/') || strlen(name) >= CMDNAME)
+    return name;
+  for(i = 0; i < NCACHE; i++)
+    if(strcmp(cmdcache[i].name, name) == 0)
+      return cmdcache[i].path;
+
+  i = nextcache++ % NCACHE;
+  path = cmdcache[i].path;
+  path[0] = '/';
+  strcpy(path+1, name);
+  if(stat(name, &st) >= 0)
+    strcpy(path, name);
+  else if(stat(path, &st) < 0){
+    cmdcache[i].name[0] = 0;
+    return name;
+  }
+  strcpy(cmdcache[i].name, name);
+  return path;
+}
+
+// Forget where name was found, since running it from there
+// failed: it may have been removed. Returns 1 if lookup()
+// had an entry for it, so that it is worth looking again.
+int
+forget(char *name)
+{
+  int i;
+
+  for(i = 0; i < NCACHE; i++){
+    if(cmdcache[i].name[0] && strcmp(cmdcache[i].name, name) == 0){
+      cmdcache[i].name[0] = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Run cmd in a child, and return its pid, or -1 if it
+// couldn't be started. A plain command is spawn()ed, which
+// doesn't copy the shell's memory as fork() does.
+int
+start(struct cmd *cmd)
+{
+  struct execcmd *ecmd;
+  int pid;
+
+  if(cmd && cmd->type == EXEC){
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return -1;
+    if((pid = spawn(lookup(ecmd->argv[0]), ecmd->argv)) < 0 &&
+       forget(ecmd->argv[0]))
+      pid = spawn(lookup(ecmd->argv[0]), ecmd->argv);
+    if(pid < 0)
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+    return pid;
+  }
+  if((pid = fork1()) == 0)
+    runcmd(cmd);
+  return pid;
+}
 
 // Execute cmd.  Never returns.
 void
@@ -75,7 +159,9 @@ runcmd(struct cmd *cmd)
     ecmd = (struct execcmd*)cmd;
     if(ecmd->argv[0] == 0)
       exit(1);
-    exec(ecmd->argv[0], ecmd->argv);
+    exec(lookup(ecmd->argv[0]), ecmd->argv);
+    if(forget(ecmd->argv[0]))
+      exec(lookup(ecmd->argv[0]), ecmd->argv);
     fprintf(2, "exec %s failed\n", ecmd->argv[0]);
     break;
 
@@ -91,9 +177,8 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(lcmd->left);
-    wait(0);
+    if(start(lcmd->left) >= 0)
+      wait(0);
     runcmd(lcmd->right);
     break;
 
@@ -123,8 +208,7 @@ runcmd(struct cmd *cmd)
 
   case BACK:
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(bcmd->cmd);
+    start(bcmd->cmd);
     break;
   }
   exit(0);
@@ -146,6 +230,7 @@ main(void)
 {
   static char buf[100];
   int fd;
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -162,6 +247,15 @@ main(void)
       buf[strlen(buf)-1] = 0;  // chop \n
       if(chdir(buf+3) < 0)
         fprintf(2, "cannot cd %s\n", buf+3);
+      memset(cmdcache, 0, sizeof(cmdcache));
+      continue;
+    }
+    if(simple(buf)){
+      // can't fail to parse, so parse it here and spawn it.
+      cmd = parsecmd(buf);
+      if(start(cmd) >= 0)
+        wait(0);
+      free(cmd);
       continue;
     }
     if(fork1() == 0)
@@ -324,6 +418,28 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// Is s a command with no operators and not too many
+// arguments, which parsecmd() can't fail on?
+int
+simple(char *s)
+{
+  int n;
+
+  for(n = 0; *s; ){
+    if(strchr(symbols, *s))
+      return 0;
+    if(strchr(whitespace, *s)){
+      s++;
+      continue;
+    }
+    if(++n >= MAXARGS)
+      return 0;
+    while(*s && !strchr(whitespace, *s) && !strchr(symbols, *s))
+      s++;
+  }
+  return 1;
+}
+
 struct cmd*
 parsecmd(char *s)
 {
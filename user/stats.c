@@ -0,0 +1,65 @@
+// stats [-q us] [cmd args...]
+//
+// print the kernel's event counters (see kernel/stats.h), or,
+// given a command, how much they changed while it ran. other
+// processes' events are counted too. -q runs the command with
+// a time slice of us microseconds (see setquantum()).
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/stats.h"
+#include "user/user.h"
+
+void
+print(struct stats *st)
+{
+  printf("sleeplock acquires %l spun %l slept %l\n",
+         st->slacquire, st->slspun, st->slslept);
+  printf("sched switches %l yields %l boosts %l\n",
+         st->switches, st->yields, st->boosts);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct stats before, after;
+  uint64 *b, *a;
+  int pid, i, q = 0;
+
+  if(argc > 2 && strcmp(argv[1], "-q") == 0){
+    q = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+
+  if(stats(&before) < 0){
+    fprintf(2, "stats: stats failed\n");
+    exit(1);
+  }
+  if(argc < 2){
+    print(&before);
+    exit(0);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "stats: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if(q > 0)
+      setquantum(q);
+    exec(argv[1], argv + 1);
+    fprintf(2, "stats: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  stats(&after);
+
+  b = (uint64*)&before;
+  a = (uint64*)&after;
+  for(i = 0; i < sizeof(after) / sizeof(uint64); i++)
+    a[i] -= b[i];
+  print(&after);
+  exit(0);
+}
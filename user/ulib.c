@@ -32,14 +32,49 @@ strlen(const char *s)
   return n;
 }
 
+// memset, memmove and memcmp work a 64-bit word at a time
+// when the pointers allow it, like their kernel versions
+// in kernel/string.c.
+
+typedef uint64 __attribute__((may_alias)) word;
+
+#define WSIZE  sizeof(word)
+#define WMASK  (WSIZE - 1)
+#define BLOCK  (8 * WSIZE)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  word w, *wdst;
+
+  w = (uchar)c;
+  w |= w << 8;
+  w |= w << 16;
+  w |= w << 32;
+
+  if((((uint64)dst | n) & (BLOCK - 1)) == 0){
+    for(wdst = dst; n > 0; n -= BLOCK, wdst += 8){
+      wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+      wdst[4] = w; wdst[5] = w; wdst[6] = w; wdst[7] = w;
+    }
+    return dst;
+  }
+
+  if(n >= WSIZE){
+    for(; (uint64)cdst & WMASK; n--)
+      *cdst++ = c;
+    wdst = (word *) cdst;
+    for(; n >= BLOCK; n -= BLOCK, wdst += 8){
+      wdst[0] = w; wdst[1] = w; wdst[2] = w; wdst[3] = w;
+      wdst[4] = w; wdst[5] = w; wdst[6] = w; wdst[7] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wdst++ = w;
+    cdst = (char *) wdst;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -98,34 +133,110 @@ atoi(const char *s)
 void*
 memmove(void *vdst, const void *vsrc, int n)
 {
-  char *dst;
-  const char *src;
+  const char *s;
+  char *d;
+  const word *ws;
+  word *wd;
+  int aligned;
 
-  dst = vdst;
-  src = vsrc;
-  if (src > dst) {
-    while(n-- > 0)
-      *dst++ = *src++;
-  } else {
-    dst += n;
-    src += n;
+  if(n <= 0)
+    return vdst;
+  s = vsrc;
+  d = vdst;
+  aligned = (((uint64)s ^ (uint64)d) & WMASK) == 0;
+
+  if((((uint64)s | (uint64)d | (uint64)n) & (BLOCK - 1)) == 0){
+    // aligned whole blocks, like pages and disk blocks.
+    ws = (const word *) s;
+    wd = (word *) d;
+    if(s < d && s + n > d){
+      for(ws += n / WSIZE, wd += n / WSIZE; n > 0; n -= BLOCK){
+        ws -= 8;
+        wd -= 8;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+    } else {
+      for(; n > 0; n -= BLOCK, ws += 8, wd += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+    }
+    return vdst;
+  }
+
+  if(s < d && s + n > d){
+    // overlapping with dst above src: copy backwards.
+    s += n;
+    d += n;
+    if(aligned && n >= WSIZE){
+      for(; (uint64)d & WMASK; n--)
+        *--d = *--s;
+      ws = (const word *) s;
+      wd = (word *) d;
+      for(; n >= BLOCK; n -= BLOCK){
+        ws -= 8;
+        wd -= 8;
+        wd[7] = ws[7]; wd[6] = ws[6]; wd[5] = ws[5]; wd[4] = ws[4];
+        wd[3] = ws[3]; wd[2] = ws[2]; wd[1] = ws[1]; wd[0] = ws[0];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      s = (const char *) ws;
+      d = (char *) wd;
+    }
     while(n-- > 0)
-      *--dst = *--src;
+      *--d = *--s;
+    return vdst;
+  }
+
+  if(aligned && n >= WSIZE){
+    for(; (uint64)d & WMASK; n--)
+      *d++ = *s++;
+    ws = (const word *) s;
+    wd = (word *) d;
+    for(; n >= BLOCK; n -= BLOCK, ws += 8, wd += 8){
+      wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+      wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = *ws++;
+    s = (const char *) ws;
+    d = (char *) wd;
   }
+  while(n-- > 0)
+    *d++ = *s++;
+
   return vdst;
 }
 
 int
-memcmp(const void *s1, const void *s2, uint n)
+memcmp(const void *v1, const void *v2, uint n)
 {
-  const char *p1 = s1, *p2 = s2;
-  while (n-- > 0) {
-    if (*p1 != *p2) {
-      return *p1 - *p2;
-    }
-    p1++;
-    p2++;
+  const uchar *s1, *s2;
+  const word *w1, *w2;
+
+  s1 = v1;
+  s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & WMASK) == 0 && n >= WSIZE){
+    for(; (uint64)s1 & WMASK; n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the byte loop below finds
+    // the first difference inside an unequal one.
+    w1 = (const word *) s1;
+    w2 = (const word *) s2;
+    for(; n >= WSIZE && *w1 == *w2; n -= WSIZE)
+      w1++, w2++;
+    s1 = (const uchar *) w1;
+    s2 = (const uchar *) w2;
   }
+  while(n-- > 0){
+    if(*s1 != *s2)
+      return *s1 - *s2;
+    s1++, s2++;
+  }
+
   return 0;
 }
 
@@ -134,3 +245,144 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// read the time CSR, which counts at a fixed rate
+// (10 MHz in qemu); start.c lets user code read it.
+uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+// read the cycle CSR, this CPU's clock cycle count.
+uint64
+rdcycle(void)
+{
+  uint64 x;
+  asm volatile("rdcycle %0" : "=r" (x));
+  return x;
+}
+
+// Threads. Each gets a TSTACK-byte stack from malloc(),
+// freed by thread_join(). malloc() itself isn't safe to call
+// from more than one thread at a time.
+#define TSTACK 4096*4
+#define NTHREAD 64
+
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static struct {
+  int tid;
+  char *stack;
+} threads[NTHREAD];
+
+static void
+threadstart(void *a)
+{
+  struct tstart *t = a;
+
+  t->fn(t->arg);
+  exit(0);
+}
+
+// Run fn(arg) in a new thread; returns its id, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  struct tstart *t;
+  char *stack;
+  int i, tid;
+
+  for(i = 0; i < NTHREAD; i++)
+    if(threads[i].stack == 0)
+      break;
+  if(i == NTHREAD || (stack = malloc(TSTACK)) == 0)
+    return -1;
+  // the start arguments go at the top of the stack, and
+  // the stack pointer below them, 16-byte aligned.
+  t = (struct tstart*)((uint64)(stack + TSTACK - sizeof(*t)) & ~15L);
+  t->fn = fn;
+  t->arg = arg;
+  if((tid = clone(threadstart, t, t)) < 0){
+    free(stack);
+    return -1;
+  }
+  threads[i].tid = tid;
+  threads[i].stack = stack;
+  return tid;
+}
+
+// Wait for thread tid to exit, and free its stack.
+int
+thread_join(int tid)
+{
+  int i;
+
+  if(join(tid, 0) < 0)
+    return -1;
+  for(i = 0; i < NTHREAD; i++){
+    if(threads[i].stack && threads[i].tid == tid){
+      free(threads[i].stack);
+      threads[i].stack = 0;
+    }
+  }
+  return 0;
+}
+
+// Mutexes and condition variables, sleeping in the kernel
+// only when contended. m->state is 0 if unlocked, 1 if
+// locked, or 2 if locked and others may be waiting.
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    futex_wake(&m->state, 1);
+  }
+}
+
+// c->seq changes with every signal, so a waiter that
+// unlocked m just before one doesn't sleep through it.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
@@ -3,8 +3,13 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Small blocks come from per-size free lists (bins): block
+// sizes are powers of two, header included, from MINBLK to
+// MAXSMALL, and malloc() and free() just pop and push. A bin
+// that runs dry is refilled by carving up a SLAB from the
+// large-block allocator; those blocks stay in their bin.
+// Larger requests go to the memory allocator by Kernighan
+// and Ritchie, The C programming Language, 2nd ed.  Section 8.7.
 
 typedef long Align;
 
@@ -18,15 +23,21 @@ union header {
 
 typedef union header Header;
 
+#define MINBLK   32
+#define MAXSMALL 1024
+#define NBIN     6      // MINBLK << NBIN-1 == MAXSMALL
+#define SLAB     8192
+#define SMALL    0x80000000  // in s.size of a small block: bin follows
+
 static Header base;
 static Header *freep;
+static Header *bin[NBIN];
 
-void
-free(void *ap)
+static void
+bigfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -56,12 +67,12 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  bigfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+bigalloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
@@ -88,3 +99,55 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+// fill bin b with blocks cut from a new slab.
+static int
+refill(int b)
+{
+  char *s, *e;
+  uint sz = MINBLK << b;
+
+  if((s = bigalloc(SLAB)) == 0)
+    return -1;
+  for(e = s + SLAB; s + sz <= e; s += sz){
+    ((Header*)s)->s.ptr = bin[b];
+    bin[b] = (Header*)s;
+  }
+  return 0;
+}
+
+void
+free(void *ap)
+{
+  Header *bp;
+  int b;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.size & SMALL){
+    b = bp->s.size & ~SMALL;
+    bp->s.ptr = bin[b];
+    bin[b] = bp;
+    return;
+  }
+  bigfree(bp);
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  int b;
+
+  if(nbytes > MAXSMALL - sizeof(Header))
+    return bigalloc(nbytes);
+  for(b = 0; (MINBLK << b) - sizeof(Header) < nbytes; b++)
+    ;
+  if(bin[b] == 0 && refill(b) < 0)
+    return 0;
+  p = bin[b];
+  bin[b] = p->s.ptr;
+  p->s.size = SMALL | b;
+  return (void*)(p + 1);
+}
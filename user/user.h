@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct stats;
+struct direntry;
 
 // system calls
 int fork(void);
@@ -23,6 +25,21 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int ringenter(int);
+int profile(int);
+int profread(void*, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int nanosleep(uint64);
+int clone(void(*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int stats(struct stats*);
+int setquantum(int);
+int getdents(int, struct direntry*, int);
+int sendfile(int, int, int);
+int spawn(char*, char**);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +57,16 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+uint64 rdtime(void);
+uint64 rdcycle(void);
+int thread_create(void(*)(void*), void*);
+int thread_join(int);
+
+// ulib.c, on futexes; zero-initialized means unlocked / no waiters
+struct mutex { int state; };
+struct cond { int seq; };
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
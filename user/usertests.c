@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/sysring.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -735,6 +736,96 @@ pipe1(char *s)
   }
 }
 
+static void
+ringsubmit(struct sysring *r, int op, int fd, void *addr, int n, int tag)
+{
+  struct ringsqe *e = &r->sq[r->sqtail % NRING];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64) addr;
+  e->n = n;
+  e->tag = tag;
+  r->sqtail++;
+}
+
+// batched write, fstat, close and read through ringenter().
+void
+ringtest(char *s)
+{
+  struct sysring *r = (struct sysring *) USYSRING;
+  struct ringcqe *c;
+  struct stat st;
+  int fd, i;
+  enum { N=8, SZ=100 };
+
+  if(r->sqhead != r->sqtail || r->cqhead != r->cqtail){
+    printf("%s: ring of new process not empty\n", s);
+    exit(1);
+  }
+
+  unlink("ringfile");
+  fd = open("ringfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N*SZ; i++)
+    buf[i] = i;
+  for(i = 0; i < N; i++)
+    ringsubmit(r, RING_WRITE, fd, buf + i*SZ, SZ, i);
+  ringsubmit(r, RING_FSTAT, fd, &st, 0, N);
+  ringsubmit(r, RING_CLOSE, fd, 0, 0, N+1);
+  ringsubmit(r, RING_CLOSE, fd, 0, 0, N+2);
+
+  if(ringenter(NRING) != N+3){
+    printf("%s: ringenter did not consume all submissions\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N+3; i++){
+    c = &r->cq[r->cqhead++ % NRING];
+    if(c->tag != i){
+      printf("%s: completion %d has tag %d\n", s, i, c->tag);
+      exit(1);
+    }
+    if((i < N && c->res != SZ) || ((i == N || i == N+1) && c->res != 0) ||
+       (i == N+2 && c->res != -1)){
+      printf("%s: completion %d returned %d\n", s, i, c->res);
+      exit(1);
+    }
+  }
+  if(st.size != N*SZ){
+    printf("%s: fstat size %d\n", s, (int)st.size);
+    exit(1);
+  }
+
+  fd = open("ringfile", O_RDONLY);
+  if(fd < 0){
+    printf("%s: reopen failed\n", s);
+    exit(1);
+  }
+  memset(buf, 0, N*SZ);
+  ringsubmit(r, RING_READ, fd, buf, N*SZ, 0);
+  ringsubmit(r, RING_CLOSE, fd, 0, 0, 1);
+  if(ringenter(1) != 1 || ringenter(1) != 1 || ringenter(1) != 0){
+    printf("%s: ringenter count wrong\n", s);
+    exit(1);
+  }
+  c = &r->cq[r->cqhead++ % NRING];
+  if(c->res != N*SZ){
+    printf("%s: ring read returned %d\n", s, c->res);
+    exit(1);
+  }
+  r->cqhead++;
+  for(i = 0; i < N*SZ; i++){
+    if(buf[i] != (char)i){
+      printf("%s: wrong data read through ring\n", s);
+      exit(1);
+    }
+  }
+  unlink("ringfile");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(char *s)
@@ -2364,6 +2455,567 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// program text is mapped read-only, and shared with every
+// other process running usertests, so writing it must kill
+// the writer.
+void
+textwrite(char *s)
+{
+  int pid;
+  int xstatus;
+
+  pid = fork();
+  if(pid == 0) {
+    volatile int *addr = (int *) textwrite;
+    *addr = 10;
+    printf("%s: textwrite: wrote text at %p\n", s, addr);
+    exit(1);
+  } else if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus == -1)  // kernel killed child?
+    exit(0);
+  else
+    exit(xstatus);
+}
+
+// mmap() a file privately and shared: private stores stay
+// private, shared stores reach the file (and read()) and a
+// forked child, and munmap() of part of a region leaves the
+// rest mapped.
+void
+mmaptest(char *s)
+{
+  char buf[512], *p, *q;
+  int fd, i, j, pid, xstatus;
+
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open mmapfile failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 2; i++){
+    memset(buf, 'a' + i, sizeof(buf));
+    for(j = 0; j < PGSIZE; j += sizeof(buf)){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("%s: write mmapfile failed\n", s);
+        exit(1);
+      }
+    }
+  }
+
+  // private: reads the file, stores stay in memory.
+  p = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 'a' || p[PGSIZE] != 'b'){
+    printf("%s: mmap private read wrong data\n", s);
+    exit(1);
+  }
+  p[0] = 'x';
+  if(munmap(p, 2*PGSIZE) != 0){
+    printf("%s: munmap private failed\n", s);
+    exit(1);
+  }
+
+  // shared: a child's stores reach the parent and the file.
+  p = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 'a'){
+    printf("%s: private store reached the file\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[1] = 'y';
+    p[PGSIZE+1] = 'z';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  if(p[1] != 'y' || p[PGSIZE+1] != 'z'){
+    printf("%s: child's store not shared\n", s);
+    exit(1);
+  }
+  i = open("mmapfile", O_RDONLY);
+  if(i < 0 || read(i, buf, 2) != 2 || buf[1] != 'y'){
+    printf("%s: read() didn't see shared store\n", s);
+    exit(1);
+  }
+  close(i);
+
+  // unmap the first page; the second stays.
+  if(munmap(p, PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  q = p + PGSIZE;
+  if(q[1] != 'z'){
+    printf("%s: munmap took the wrong page\n", s);
+    exit(1);
+  }
+  q[2] = 'w';
+  if(munmap(q, PGSIZE) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[1] != 'y'){
+    printf("%s: shared store not written back\n", s);
+    exit(1);
+  }
+  for(j = sizeof(buf); j < PGSIZE; j += sizeof(buf))
+    read(fd, buf, sizeof(buf));
+  if(read(fd, buf, 3) != 3 || buf[1] != 'z' || buf[2] != 'w'){
+    printf("%s: shared store not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // a read-only descriptor can't be mapped shared and writable.
+  fd = open("mmapfile", O_RDONLY);
+  if(mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1){
+    printf("%s: mmap shared writable of read-only fd succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+}
+
+// nanosleep() sleeps at least as long as asked, and sleepers
+// with different deadlines wake in deadline order.
+void
+nanosleeptest(char *s)
+{
+  int fds[2], i, pid;
+  uint64 t0;
+  char c;
+
+  t0 = rdtime();
+  if(nanosleep(20*1000*1000) != 0 || rdtime() - t0 < TIMEFREQ/50){
+    printf("%s: nanosleep returned early\n", s);
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 3; i > 0; i--){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      nanosleep(i*20*1000*1000);
+      c = '0' + i;
+      write(fds[1], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  for(i = 1; i <= 3; i++){
+    if(read(fds[0], &c, 1) != 1 || c != '0' + i){
+      printf("%s: sleepers woke out of order\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < 3; i++)
+    wait(0);
+  close(fds[0]);
+}
+
+// threads share memory, run at the same time, and are
+// reaped by join() but not wait().
+#define NTT 4
+static volatile int tcount[NTT];
+static volatile int tgo;
+
+static void
+threadbody(void *arg)
+{
+  int i = (uint64)arg;
+
+  while(tgo == 0)
+    ;
+  for(int j = 0; j < 100000; j++)
+    tcount[i]++;
+}
+
+void
+threadtest(char *s)
+{
+  int tids[NTT], i;
+
+  tgo = 0;
+  for(i = 0; i < NTT; i++){
+    tcount[i] = 0;
+    if((tids[i] = thread_create(threadbody, (void*)(uint64)i)) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  if(wait(0) != -1){
+    printf("%s: wait() reaped a thread\n", s);
+    exit(1);
+  }
+  tgo = 1;
+  for(i = 0; i < NTT; i++){
+    if(thread_join(tids[i]) != 0){
+      printf("%s: thread_join failed\n", s);
+      exit(1);
+    }
+    if(tcount[i] != 100000){
+      printf("%s: thread %d counted %d\n", s, i, tcount[i]);
+      exit(1);
+    }
+  }
+  if(join(tids[0], 0) != -1){
+    printf("%s: joined a thread twice\n", s);
+    exit(1);
+  }
+}
+
+// threads share open files and the current directory: a
+// file a thread opens stays open for the others after the
+// thread exits, and a chdir() moves them all.
+static int tfd;
+
+static void
+threadfilesbody(void *arg)
+{
+  tfd = open("tfiles", O_CREATE|O_RDWR);
+  chdir("tfilesdir");
+}
+
+void
+threadfiles(char *s)
+{
+  int tid, fd;
+
+  unlink("tfilesdir/tfiles2");
+  unlink("tfilesdir");
+  unlink("tfiles");
+  if(mkdir("tfilesdir") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  if((tid = thread_create(threadfilesbody, 0)) < 0){
+    printf("%s: thread_create failed\n", s);
+    exit(1);
+  }
+  if(thread_join(tid) != 0){
+    printf("%s: thread_join failed\n", s);
+    exit(1);
+  }
+  if(tfd < 0 || write(tfd, "x", 1) != 1){
+    printf("%s: thread's fd not usable\n", s);
+    exit(1);
+  }
+  close(tfd);
+  if((fd = open("tfiles2", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create in thread's cwd failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  chdir("..");
+  if(unlink("tfilesdir/tfiles2") < 0){
+    printf("%s: thread's chdir() didn't move the process\n", s);
+    exit(1);
+  }
+  unlink("tfilesdir");
+  unlink("tfiles");
+}
+
+// a process's exit() ends its other threads before its
+// parent's wait() returns: they don't run on as children
+// of init.
+static int tepipe[2];
+
+static void
+threadexitbody(void *arg)
+{
+  for(;;){
+    write(tepipe[1], "x", 1);
+    sleep(1);
+  }
+}
+
+void
+threadexit(char *s)
+{
+  int pid, n;
+  char c;
+
+  if(pipe(tepipe) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(thread_create(threadexitbody, 0) < 0)
+      exit(1);
+    sleep(3);
+    exit(0);
+  }
+  close(tepipe[1]);
+  wait(0);
+  // what the thread wrote before it died, then EOF.
+  for(n = 0; read(tepipe[0], &c, 1) == 1; n++){
+    if(n > 50){
+      printf("%s: thread outlived its process\n", s);
+      exit(1);
+    }
+  }
+  close(tepipe[0]);
+}
+
+// threads incrementing a counter under a futex mutex
+// don't lose updates, and a condition variable wakes the
+// thread waiting for them all to finish.
+static struct mutex fmu;
+static struct cond fdone;
+static int fcount, fleft;
+
+static void
+futexbody(void *arg)
+{
+  for(int j = 0; j < 10000; j++){
+    mutex_lock(&fmu);
+    fcount++;
+    mutex_unlock(&fmu);
+  }
+  mutex_lock(&fmu);
+  if(--fleft == 0)
+    cond_signal(&fdone);
+  mutex_unlock(&fmu);
+}
+
+void
+futextest(char *s)
+{
+  int tids[NTT], i, x;
+
+  x = 1;
+  if(futex_wait(&x, 0) != -1){
+    printf("%s: futex_wait slept on a changed word\n", s);
+    exit(1);
+  }
+  fcount = 0;
+  fleft = NTT;
+  for(i = 0; i < NTT; i++){
+    if((tids[i] = thread_create(futexbody, 0)) < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  mutex_lock(&fmu);
+  while(fleft > 0)
+    cond_wait(&fdone, &fmu);
+  mutex_unlock(&fmu);
+  for(i = 0; i < NTT; i++)
+    thread_join(tids[i]);
+  if(fcount != NTT*10000){
+    printf("%s: count %d, not %d\n", s, fcount, NTT*10000);
+    exit(1);
+  }
+}
+
+// sendfile() copies a file to a file at the offsets of both,
+// and to a pipe, but refuses to read from a pipe.
+void
+sendfiletest(char *s)
+{
+  int fd, fd2, p[2], i, n;
+
+  unlink("sendf1");
+  unlink("sendf2");
+  fd = open("sendf1", O_CREATE|O_RDWR);
+  for(i = 0; i < 3*BSIZE; i++)
+    buf[i] = 'a' + i % 23;
+  if(fd < 0 || write(fd, buf, 3*BSIZE) != 3*BSIZE){
+    printf("%s: create sendf1 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("sendf1", O_RDONLY);
+  fd2 = open("sendf2", O_CREATE|O_RDWR);
+  if(fd < 0 || fd2 < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  read(fd, buf, 10);
+  if((n = sendfile(fd2, fd, 3*BSIZE)) != 3*BSIZE - 10){
+    printf("%s: sendfile to a file returned %d\n", s, n);
+    exit(1);
+  }
+  if(sendfile(fd2, fd, 100) != 0){
+    printf("%s: sendfile at end of file didn't return 0\n", s);
+    exit(1);
+  }
+  close(fd2);
+  fd2 = open("sendf2", O_RDONLY);
+  if(read(fd2, buf, sizeof(buf)) != 3*BSIZE - 10){
+    printf("%s: sendf2 has the wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*BSIZE - 10; i++){
+    if(buf[i] != 'a' + (i + 10) % 23){
+      printf("%s: sendf2 has the wrong contents\n", s);
+      exit(1);
+    }
+  }
+  close(fd2);
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("sendf1", O_RDONLY);
+  if(sendfile(p[1], fd, 100) != 100 || read(p[0], buf, 100) != 100 ||
+     buf[99] != 'a' + 99 % 23){
+    printf("%s: sendfile to a pipe failed\n", s);
+    exit(1);
+  }
+  if(sendfile(fd, p[0], 10) != -1){
+    printf("%s: sendfile from a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+  close(fd);
+  unlink("sendf1");
+  unlink("sendf2");
+}
+
+// spawn() runs a program in a child that wait() reaps, and
+// fails, leaving no child, if the program doesn't exist.
+void
+spawntest(char *s)
+{
+  char *args[] = { "mkdir", "spawndir", 0 };
+  char *bad[] = { "nonexistent", 0 };
+  int pid, xst;
+
+  unlink("spawndir");
+  if((pid = spawn("mkdir", args)) < 0){
+    printf("%s: spawn mkdir failed\n", s);
+    exit(1);
+  }
+  if(wait(&xst) != pid || xst != 0){
+    printf("%s: wait for spawned child failed\n", s);
+    exit(1);
+  }
+  if(unlink("spawndir") < 0){
+    printf("%s: spawned mkdir didn't run\n", s);
+    exit(1);
+  }
+  if(spawn("nonexistent", bad) != -1){
+    printf("%s: spawn of a nonexistent program succeeded\n", s);
+    exit(1);
+  }
+  if(wait(0) != -1){
+    printf("%s: failed spawn left a child\n", s);
+    exit(1);
+  }
+}
+
+// a running program's text is mapped from the page cache,
+// so its file can't be opened for writing meanwhile.
+void
+textbusy(char *s)
+{
+  int fd;
+
+  if((fd = open("usertests", O_RDWR)) >= 0){
+    printf("%s: opened a running program for writing\n", s);
+    exit(1);
+  }
+  if((fd = open("usertests", O_RDONLY)) < 0){
+    printf("%s: can't open a running program to read\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// regression test. xargs used to pack MAXARG arguments into a
+// command, leaving exec() no room for the terminating 0, so the
+// command failed to run.
+void
+xargsmax(char *s)
+{
+  int p[2], pid, fd, i, n, xst;
+  char *args[] = { "xargs", "echo", 0 };
+  char buf[256];
+
+  unlink("xargsout");
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(p[0]);
+    close(p[0]);
+    close(p[1]);
+    close(1);
+    if(open("xargsout", O_CREATE|O_WRONLY) != 1)
+      exit(1);
+    exec("xargs", args);
+    exit(1);
+  }
+  close(p[0]);
+  for(i = 0; i < 2*MAXARG; i++)
+    write(p[1], "x\n", 2);
+  close(p[1]);
+  if(wait(&xst) != pid || xst != 0){
+    printf("%s: xargs failed\n", s);
+    exit(1);
+  }
+
+  if((fd = open("xargsout", O_RDONLY)) < 0){
+    printf("%s: no xargs output\n", s);
+    exit(1);
+  }
+  n = 0;
+  while((i = read(fd, buf, sizeof(buf))) > 0)
+    while(i-- > 0)
+      if(buf[i] == 'x')
+        n++;
+  close(fd);
+  unlink("xargsout");
+  if(n != 2*MAXARG){
+    printf("%s: xargs echoed %d words, not %d\n", s, n, 2*MAXARG);
+    exit(1);
+  }
+}
+
 // regression test. copyin(), copyout(), and copyinstr() used to cast
 // the virtual page address to uint, which (with certain wild system
 // call arguments) resulted in a kernel page faults.
@@ -2526,6 +3178,41 @@ execout(char *s)
   exit(0);
 }
 
+// like execout, but exec()s a bigger program, usertests, with
+// up to 40 pages free, so that exec() runs out of memory at
+// each point of loading its segments, including partway
+// through one. it used to panic in freewalk() when that
+// happened.
+void
+execoutbig(char *s)
+{
+  for(int avail = 0; avail < 40; avail++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed\n");
+      exit(1);
+    } else if(pid == 0){
+      while(1){
+        uint64 a = (uint64) sbrk(4096);
+        if(a == 0xffffffffffffffffLL)
+          break;
+        *(char*)(a + 4096 - 1) = 1;
+      }
+      for(int i = 0; i < avail; i++)
+        sbrk(-4096);
+
+      close(1);
+      char *args[] = { "usertests", "-x", 0 };
+      exec("usertests", args);
+      exit(0);
+    } else {
+      wait((int*)0);
+    }
+  }
+
+  exit(0);
+}
+
 //
 // use sbrk() to count how many free physical memory pages there are.
 // touches the pages to force allocation.
@@ -2639,6 +3326,7 @@ main(int argc, char *argv[])
     char *s;
   } tests[] = {
     {execout, "execout"},
+    {execoutbig, "execoutbig"},
     {copyin, "copyin"},
     {copyout, "copyout"},
     {copyinstr1, "copyinstr1"},
@@ -2676,6 +3364,17 @@ main(int argc, char *argv[])
     {sbrkarg, "sbrkarg"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
+    {textwrite, "textwrite"},
+    {mmaptest, "mmaptest"},
+    {nanosleeptest, "nanosleeptest"},
+    {threadtest, "threadtest"},
+    {threadfiles, "threadfiles"},
+    {threadexit, "threadexit"},
+    {futextest, "futextest"},
+    {sendfiletest, "sendfiletest"},
+    {spawntest, "spawntest"},
+    {xargsmax, "xargsmax"},
+    {textbusy, "textbusy"},
     {opentest, "opentest"},
     {writetest, "writetest"},
     {writebig, "writebig"},
@@ -2685,6 +3384,7 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {ringtest, "ringtest"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
@@ -36,3 +36,18 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("ringenter");
+entry("profile");
+entry("profread");
+entry("mmap");
+entry("munmap");
+entry("nanosleep");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("stats");
+entry("setquantum");
+entry("getdents");
+entry("sendfile");
+entry("spawn");
@@ -1,109 +1,135 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
 #include "user/user.h"
 
-int main(int ac, char *av[])
+// xargs [-n max] [-P procs] cmd [args...]
+//
+// Run cmd with args, followed by the words read from standard
+// input, packing as many words into each command as fit: up
+// to max of them (default as many as exec() takes, MAXARG-1,
+// leaving room for the terminating 0), in up to ARGBYTES
+// bytes. Up to procs commands (default 1) run at once.
+
+#define ARGBYTES 2048  // exec() copies arguments to a one-page stack
+
+char in[512];
+int nin, pin;
+
+char argbuf[ARGBYTES];
+char word[ARGBYTES];  // the word being read
+char *args[MAXARG+1];
+int nfixed;
+
+int maxprocs = 1;
+int running;
+int failed;
+
+int readc(void)
 {
-    char buf[100];
-    char *p = buf;
-    char *str[10];
-    int count = 0;
-    int mode = 9999;
-    int i = 1;
-    int pid;
-    int cl = 0;
-/*    int pl[2];
-    int tmp = 0;
-
-    // test workaround
-    if (pipe(pl) != 0)
+    if (pin == nin)
     {
-        printf("error: pipe failed\n");
-        exit(1);
+        if ((nin = read(0, in, sizeof in)) <= 0)
+            return -1;
+        pin = 0;
     }
+    return (uchar)in[pin++];
+}
 
-    char *tmpS[] = {"\"1\n2\"",
-                    "hello too"};
-    if (tmp == 1)
+int isspace(int c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// read the next word into w, which has room for max bytes.
+// returns its length, 0 at the end of input, or -1 if too
+// long.
+int getword(char *w, int max)
+{
+    int c, n;
+
+    while ((c = readc()) >= 0 && isspace(c))
+        ;
+    for (n = 0; c >= 0 && !isspace(c); c = readc())
     {
-        write(pl[1], tmpS[1], strlen(tmpS[1]));
+        if (n + 1 >= max)
+            return -1;
+        w[n++] = c;
     }
-    else
+    w[n] = 0;
+    return n;
+}
+
+void reap(void)
+{
+    int st;
+
+    if (wait(&st) >= 0 && st != 0)
+        failed = 1;
+    running--;
+}
+
+// spawn() rather than fork(): the child doesn't need a copy
+// of argbuf and the rest of our memory.
+void run(int argc)
+{
+    if (running == maxprocs)
+        reap();
+    args[argc] = 0;
+    if (spawn(args[0], args) < 0)
     {
-        write(pl[1], tmpS[0], strlen(tmpS[0]));
+        fprintf(2, "xargs: exec %s failed\n", args[0]);
+        failed = 1;
+        return;
     }
-    close(pl[1]); */
+    running++;
+}
 
-    if (!strcmp(av[1], "-n"))
+int main(int ac, char *av[])
+{
+    int maxn = MAXARG;
+    int i, n, argc, used;
+
+    for (i = 1; i + 1 < ac && av[i][0] == '-'; i += 2)
     {
-        mode = *(av[2]) - '0';
-        i = 3;
+        if (!strcmp(av[i], "-n"))
+            maxn = atoi(av[i + 1]);
+        else if (!strcmp(av[i], "-P"))
+            maxprocs = atoi(av[i + 1]);
+        else
+            break;
     }
-
-    for (; i < ac; i++)
+    if (i == ac || maxn < 1 || maxprocs < 1 || ac - i >= MAXARG - 1)
     {
-        //printf("%d: %s\n", i, av[i]);
-        str[count++] = av[i];
+        fprintf(2, "usage: xargs [-n max] [-P procs] cmd [args...]\n");
+        exit(1);
     }
-    while (read(0, buf, 1) > 0)
+    for (; i < ac; i++)
+        args[nfixed++] = av[i];
+
+    argc = nfixed;
+    used = 0;
+    while ((n = getword(word, sizeof word)) != 0)
     {
-        pid = fork();
-        if (pid < 0)
+        if (n < 0)
         {
-            printf("error: fork failed\n");
+            fprintf(2, "xargs: argument too long\n");
             exit(1);
         }
-        if (pid > 0)
+        if (argc > nfixed && (argc - nfixed == maxn || argc == MAXARG - 1 ||
+                              used + n + 1 > ARGBYTES))
         {
-            wait(0);
-            continue;
+            run(argc);
+            argc = nfixed;
+            used = 0;
         }
-        if (*p != '"')
-            p = buf + 1;
-        str[count++] = buf;
-
-        for (int num = 0; num < mode;)
-        {
-            if (read(0, p, 1) < 1)
-                break;
-            if (*p == '"')
-            {
-                //printf("\" come\n");
-                continue;
-            }
-            if (*p == '\\')
-            {
-                p++;
-                if (read(0, p, 1) < 1)
-                    break;
-                if (*p == 'n')
-                {
-                    *p = 0;
-                    cl = 1;
-                    p--;
-                }
-            }
-
-            // printf("num%d:%c\n", num, *p);
-            if (*p == ' ' || cl == 1 || *p == '\n')
-            {
-                //printf("end:%d\n", (int)(*p));
-                *(p++) = '\0';
-                num++;
-                //printf("str:%s, p:%s\n", str[count], p);
-                str[count++] = p;
-                if (cl == 1)
-                    cl = 0;
-                continue;
-            }
-            p++;
-        }
-        str[count] = 0;
-        //for (i = 0; i < count; i++)
-        //    printf("%d:%s\n", i, str[i]);
-        //close(pl[0]);
-        exec(str[0], str);
-        printf("Error: exec failed\n");
+        args[argc++] = memmove(argbuf + used, word, n + 1);
+        used += n + 1;
     }
-    exit(0);
-}
\ No newline at end of file
+    if (argc > nfixed)
+        run(argc);
+    while (running > 0)
+        reap();
+
+    exit(failed);
+}